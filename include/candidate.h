@@ -0,0 +1,12 @@
+/* strongest signal candidates of a search, kept in a heap whose root is
+   the weakest one kept */
+
+struct CANDIDATE {
+  double  time;			/* start time of the spectrum or block, s */
+  double  freq;			/* frequency, at start of block if drifting, Hz */
+  double  drift;		/* drift rate, 0 if not searched, Hz/s */
+  float   snr;			/* signal to noise ratio */
+};
+
+void cand_push( struct CANDIDATE *, int *, int, struct CANDIDATE * );
+void cand_sort( struct CANDIDATE *, int );
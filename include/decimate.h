@@ -0,0 +1,49 @@
+
+struct FIRDEC {
+  int     ntaps;		/* number of taps */
+  int     factor;		/* decimation factor */
+  int     width;		/* floats in a window of taps, a multiple of FIR_LANES */
+  float  *taps;			/* taps for I and Q, interleaved, padded to width */
+  float  *work;			/* ntaps - 1 samples of history, then new samples */
+  int     size;			/* capacity of work, complex samples */
+  int     next;			/* offset of the next output in the new samples */
+};
+
+#define FIR_LANES 16		/* independent partial sums of a dot product */
+#define CIC_MAXORDER 4		/* maximum number of CIC stages */
+
+struct CICDEC {
+  int     factor;		/* decimation factor */
+  int     order;		/* number of integrator and comb stages */
+  unsigned long long integ[2][CIC_MAXORDER];	/* I and Q integrators */
+  unsigned long long comb[2][CIC_MAXORDER];	/* I and Q comb delays */
+  int     phase;		/* samples integrated since the last output */
+  double  gain;			/* scale of the outputs for unit gain */
+};
+
+struct DECIMATOR {
+  int     factor;		/* decimation factor */
+  struct FIRDEC *fir;		/* the single stage, or the last one */
+  struct CICDEC *cic;		/* first stage for large factors, or NULL */
+  struct FIRDEC *box;		/* the CIC stage as a filter, for float samples */
+  struct FIRDEC *comp;		/* filter compensating the CIC stage */
+};
+
+#define CIC_MIN_FACTOR 64	/* smallest factor decimated in stages */
+#define CIC_COMP_TAPS 24	/* taps of the compensating filter */
+#define CIC_LAST_TAPS 63	/* taps of the last filter */
+
+struct FIRDEC *fir_open( int, int, double, double, double );
+float *fir_input( struct FIRDEC *, int );
+int fir_decimate( struct FIRDEC *, int, float * );
+int fir_count( struct FIRDEC *, int );
+void fir_range( struct FIRDEC *, int, int, float * );
+void fir_advance( struct FIRDEC *, int );
+void fir_close( struct FIRDEC * );
+struct FIRDEC *fir_comp( int, int, int, double, double, double );
+struct CICDEC *cic_open( int, int );
+int cic_decimate( struct CICDEC *, signed char *, int, float * );
+struct DECIMATOR *dec_open( int, int, double, double, double, int );
+float *dec_input( struct DECIMATOR *, int );
+int dec_decimate( struct DECIMATOR *, signed char *, int, float * );
+void dec_close( struct DECIMATOR * );
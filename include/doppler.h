@@ -0,0 +1,25 @@
+
+struct DOPPLER {
+  int     npoly;		/* number of polynomial coefficients, 0 for a table */
+  double  t0;			/* reference time of polynomial, s */
+  double  poly[16];		/* polynomial coefficients, Hz / s^k */
+  int     ntab;			/* number of table entries */
+  double *tabt;			/* table times, s */
+  double *tabf;			/* table frequencies, Hz */
+  double *tabphase;		/* phase at table times, cycles */
+  int     seg;			/* table segment of last evaluation */
+  double  tsamp;		/* sample interval, s */
+  double  start;		/* time of first sample, s */
+  long long count;		/* number of samples mixed */
+  double  offset;		/* constant frequency added to the model, Hz */
+};
+
+#define DOPPLER_BLOCK 4096	/* samples between exact phase evaluations */
+#define DOPPLER_LANES 8		/* independent rotators within a block */
+
+struct DOPPLER *doppler_open( char *, double, double );
+struct DOPPLER *doppler_const( double, double, double );
+void doppler_offset( struct DOPPLER *, double );
+double doppler_freq( struct DOPPLER *, double );
+void doppler_mix( struct DOPPLER *, float *, int );
+void doppler_close( struct DOPPLER * );
@@ -0,0 +1,50 @@
+
+/* self-describing file of spectra: a header padded to SPEC_HDRSIZE bytes,
+   the spectra as nchan floats each, and an index of the spectra */
+
+struct SPECHEADER {
+  char    magic[8];		/* "PFSSPEC" */
+  int     size;			/* size of this structure */
+  int     version;		/* SPEC_VERSION */
+  int     mode;			/* data mode of the transformed samples */
+  int     fftlen;		/* transform length, complex samples */
+  int     nchan;		/* channels in each spectrum */
+  int     downsample;		/* downsampling factor before the transform */
+  double  fsamp;		/* sampling frequency before downsampling, MHz */
+  double  freqres;		/* frequency resolution, Hz */
+  double  freqmin;		/* frequency of the first channel, Hz */
+  double  start;		/* time of the first transform from start of data, s */
+  double  tint;			/* time between spectra, s */
+  long long sum;		/* number of transforms summed in each spectrum */
+  long long nspectra;		/* number of spectra, 0 until the file is closed */
+  long long index;		/* file offset of the index, 0 until the file is closed */
+  char    command[1024];	/* command line that produced the file */
+};
+
+struct SPECINDEX {
+  long long offset;		/* file offset of spectrum */
+  double  time;			/* time of its first transform, s */
+};
+
+struct SPECFILE {
+  struct SPECHEADER *hdr;	/* header, in the mapped file when reading */
+  struct SPECINDEX *index;	/* index, in the mapped file when reading, or NULL */
+  long long nspectra;		/* number of spectra */
+  char   *map;			/* mapped file when reading */
+  size_t  maplen;
+  FILE   *fp;			/* output file when writing */
+  struct SPECHEADER head;	/* header being written */
+};
+
+#define SPEC_VERSION 1
+#define SPEC_HDRSIZE 4096	/* spectra start on a page boundary */
+
+struct SPECFILE *spec_create( FILE *, struct SPECHEADER * );
+int spec_write( struct SPECFILE *, float * );
+void spec_extend( struct SPECFILE *, long long );
+void spec_integration( struct SPECFILE *, long long, double );
+int spec_probe( char * );
+struct SPECFILE *spec_open( char * );
+float *spec_data( struct SPECFILE *, long long );
+double spec_time( struct SPECFILE *, long long );
+void spec_close( struct SPECFILE * );
@@ -0,0 +1,45 @@
+
+#include <pthread.h>
+
+struct STREAMFILE {
+  int fd;
+  int seekable;		/* regular file, skips may use lseek */
+  char *buf;		/* readahead buffer */
+  long size;		/* size of readahead buffer */
+  long pos;		/* next unread byte in readahead buffer */
+  long len;		/* number of valid bytes in readahead buffer */
+  int eof;
+  long long offset;	/* number of bytes delivered or skipped so far */
+  int follow;		/* seconds to wait for more data at EOF, 0 to stop */
+  int idle;		/* milliseconds spent waiting for more data */
+  int hasnext;		/* next file of a multifile series existed */
+  int drained;		/* tail of current file reread after EOF */
+  int series;		/* continue with the next file of a multifile series at EOF */
+  long long limit;	/* offset at which to stop delivering data, 0 for none */
+  char name[256];
+  int ahead;		/* a readahead thread fills the ring */
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *ring;		/* nslots chunks of size bytes */
+  long *fill;		/* number of valid bytes in each chunk */
+  int nslots;
+  long long head;	/* number of chunks filled by the thread */
+  long long tail;	/* number of chunks consumed, the current one included */
+  int done;		/* the thread reached EOF, or an error if negative */
+  int thread;		/* the thread was started */
+};
+
+#define STREAM_BUFSIZE (8 * 1024 * 1024)
+#define STREAM_POLL_MS 250
+#define STREAM_SLOTS 4		/* default number of readahead chunks */
+
+struct STREAMFILE *stream_open( char *, long );
+long stream_read( struct STREAMFILE *, char *, long );
+long long stream_skip( struct STREAMFILE *, long long );
+int stream_close( struct STREAMFILE * );
+void stream_follow( struct STREAMFILE *, int );
+void stream_series( struct STREAMFILE * );
+void stream_limit( struct STREAMFILE *, long long );
+int stream_readahead( struct STREAMFILE *, int );
+long long stream_size( char *, int );
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "candidate.h"
+
+/* top-K selection of the strongest candidates of a search, in a heap */
+/* that grows to maxcand entries and then replaces its weakest one   */
+
+static int cand_compare( const void *, const void * );
+
+/******************************************************************************/
+/*	cand_push							      */
+/******************************************************************************/
+void cand_push (struct CANDIDATE *heap, int *ncand, int maxcand, struct CANDIDATE *cand)
+{
+  /* keeps the maxcand strongest candidates in heap, which holds *ncand of
+     them with the weakest one at the root
+  */
+  struct CANDIDATE tmp;
+  int    i, child;
+
+  if (*ncand < maxcand)
+    {
+      /* add at the bottom and sift up */
+      i = (*ncand)++;
+      heap[i] = *cand;
+      while (i > 0 && heap[(i-1)/2].snr > heap[i].snr)
+	{
+	  tmp = heap[i];
+	  heap[i] = heap[(i-1)/2];
+	  heap[(i-1)/2] = tmp;
+	  i = (i-1)/2;
+	}
+      return;
+    }
+
+  if (maxcand == 0 || cand->snr <= heap[0].snr)
+    return;
+
+  /* replace the weakest and sift down */
+  heap[0] = *cand;
+  i = 0;
+  while ((child = 2*i + 1) < *ncand)
+    {
+      if (child + 1 < *ncand && heap[child+1].snr < heap[child].snr)
+	child++;
+      if (heap[i].snr <= heap[child].snr)
+	break;
+      tmp = heap[i];
+      heap[i] = heap[child];
+      heap[child] = tmp;
+      i = child;
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	cand_sort							      */
+/******************************************************************************/
+void cand_sort (struct CANDIDATE *heap, int ncand)
+{
+  /* sorts the ncand candidates of heap by decreasing SNR, after which heap
+     must be emptied before the next cand_push
+  */
+  qsort(heap, ncand, sizeof(struct CANDIDATE), cand_compare);
+  return;
+}
+
+/******************************************************************************/
+/*	cand_compare							      */
+/******************************************************************************/
+static int cand_compare (const void *a, const void *b)
+{
+  /* orders candidates by decreasing SNR */
+  float snra = ((struct CANDIDATE *) a)->snr;
+  float snrb = ((struct CANDIDATE *) b)->snr;
+
+  return (snra < snrb) - (snra > snrb);
+}
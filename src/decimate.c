@@ -0,0 +1,550 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decimate.h"
+
+/* decimation of complex samples with anti-aliasing filters, keeping the */
+/* filter state from one buffer to the next                              */
+
+static double bessel_i0( double );
+static double kaiser( int, int, double );
+static struct FIRDEC *fir_make( int, int, double *, double );
+static double cic_response( double, int, int );
+static struct FIRDEC *fir_cic( int, int );
+
+/******************************************************************************/
+/*	fir_open							      */
+/******************************************************************************/
+struct FIRDEC *fir_open (int ntaps, int factor, double pass, double stop, double gain)
+{
+  /* designs a lowpass filter of ntaps taps for decimation by factor, with
+     passband and stopband edges pass and stop in units of the output
+     sampling rate (0.4 and 0.6 keep aliases out of |f| < 0.4), as a
+     Kaiser windowed sinc whose window follows from the length and the
+     transition width; the taps add up to gain
+     returns NULL on a bad design or allocation error
+  */
+  struct FIRDEC *f;
+  double fc, dw, x;
+  double *h;
+  int    n;
+
+  if (ntaps < 1 || factor < 1 || pass <= 0 || stop <= pass)
+    return NULL;
+  if ((h = (double *) malloc(ntaps * sizeof(double))) == NULL)
+    return NULL;
+
+  /* cutoff and transition width, cycles per input sample */
+  fc = 0.5 * (pass + stop) / factor;
+  dw = (stop - pass) / factor;
+
+  for (n = 0; n < ntaps; n++)
+    {
+      x = n - 0.5 * (ntaps - 1);
+      h[n] = (x == 0) ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+      h[n] *= kaiser(n, ntaps, dw);
+    }
+
+  f = fir_make(ntaps, factor, h, gain);
+  free(h);
+  return f;
+}
+
+/******************************************************************************/
+/*	fir_comp							      */
+/******************************************************************************/
+struct FIRDEC *fir_comp (int ntaps, int order, int cicfactor, double pass, double stop, double gain)
+{
+  /* designs a filter of ntaps taps for decimation by 2 of the output of a
+     CIC decimator of that order and factor, flattening its passband
+     |f| < pass and rejecting |f| > stop, in units of the CIC output rate;
+     the response is sampled on a fine grid, tapered linearly to zero
+     across the transition, and transformed, then Kaiser windowed
+     returns NULL on a bad design or allocation error
+  */
+  struct FIRDEC *f;
+  double *h;
+  double nu, a, apass, x;
+  int    n, k;
+  int    ngrid = 4096;
+
+  if (ntaps < 1 || pass <= 0 || stop <= pass || stop > 0.5)
+    return NULL;
+  if ((h = (double *) calloc(ntaps, sizeof(double))) == NULL)
+    return NULL;
+
+  apass = 1 / cic_response(pass, order, cicfactor);
+  for (k = 0; k <= ngrid; k++)
+    {
+      nu = 0.5 * k / ngrid;
+      if (nu <= pass)
+	a = 1 / cic_response(nu, order, cicfactor);
+      else if (nu < stop)
+	a = apass * (stop - nu) / (stop - pass);
+      else
+	break;
+      if (k == 0) a *= 0.5;		/* trapezoidal rule */
+      for (n = 0; n < ntaps; n++)
+	{
+	  x = n - 0.5 * (ntaps - 1);
+	  h[n] += 2 * a * cos(2 * M_PI * nu * x) * 0.5 / ngrid;
+	}
+    }
+  for (n = 0; n < ntaps; n++)
+    h[n] *= kaiser(n, ntaps, stop - pass);
+
+  f = fir_make(ntaps, 2, h, gain);
+  free(h);
+  return f;
+}
+
+/******************************************************************************/
+/*	cic_response							      */
+/******************************************************************************/
+static double cic_response (double nu, int order, int factor)
+{
+  /* amplitude response of a CIC decimator at nu cycles per output
+     sample, normalized to 1 at zero frequency
+  */
+  if (nu == 0)
+    return 1;
+  return pow(fabs(sin(M_PI * nu) / (factor * sin(M_PI * nu / factor))), order);
+}
+
+/******************************************************************************/
+/*	kaiser								      */
+/******************************************************************************/
+static double kaiser (int n, int ntaps, double dw)
+{
+  /* Kaiser window for tap n of ntaps, for a transition width of dw
+     cycles per sample, with the stopband attenuation (dB) this length
+     can reach
+  */
+  double att, beta, c, w;
+
+  att = 14.36 * dw * (ntaps - 1) + 7.95;
+  if (att > 50)
+    beta = 0.1102 * (att - 8.7);
+  else if (att > 21)
+    beta = 0.5842 * pow(att - 21, 0.4) + 0.07886 * (att - 21);
+  else
+    beta = 0;
+
+  c = 0.5 * (ntaps - 1);
+  w = (c > 0) ? (n - c) / c : 0;
+  return bessel_i0(beta * sqrt(1 - w * w)) / bessel_i0(beta);
+}
+
+/******************************************************************************/
+/*	fir_make							      */
+/******************************************************************************/
+static struct FIRDEC *fir_make (int ntaps, int factor, double *h, double gain)
+{
+  /* makes a decimator by factor with the ntaps taps h, scaled so that
+     they add up to gain
+  */
+  struct FIRDEC *f;
+  double sum;
+  int    n;
+
+  f = (struct FIRDEC *) calloc(1, sizeof(struct FIRDEC));
+  if (f == NULL)
+    return NULL;
+  f->ntaps  = ntaps;
+  f->factor = factor;
+  f->width  = (2 * ntaps + FIR_LANES - 1) / FIR_LANES * FIR_LANES;
+
+  /* taps in the order of the samples they multiply, each for I and Q */
+  f->taps = (float *) calloc(f->width, sizeof(float));
+  if (f->taps == NULL)
+    {
+      free(f);
+      return NULL;
+    }
+  for (n = 0, sum = 0; n < ntaps; n++)
+    sum += h[n];
+  for (n = 0; n < ntaps; n++)
+    f->taps[2*n] = f->taps[2*n+1] = gain * h[ntaps - 1 - n] / sum;
+
+  /* the first output ends the first block of factor samples */
+  f->next = factor - 1;
+  return f;
+}
+
+/******************************************************************************/
+/*	bessel_i0							      */
+/******************************************************************************/
+static double bessel_i0 (double x)
+{
+  /* modified Bessel function of the first kind, order 0 */
+  double term = 1, sum = 1;
+  int    k;
+
+  for (k = 1; term > 1e-12 * sum; k++)
+    {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+    }
+  return sum;
+}
+
+/******************************************************************************/
+/*	fir_input							      */
+/******************************************************************************/
+float *fir_input (struct FIRDEC *f, int nsamples)
+{
+  /* returns where the caller places the next nsamples complex samples,
+     after the history kept from the previous ones
+  */
+  int nhist = f->ntaps - 1;
+  int len;
+
+  if (nsamples > f->size)
+    {
+      /* the last window may extend past the samples into zeroed floats */
+      len = 2 * (nhist + nsamples) + f->width;
+      f->work = (float *) realloc(f->work, len * sizeof(float));
+      if (f->work == NULL)
+	{
+	  fprintf(stderr,"Malloc error\n");
+	  exit(1);
+	}
+      if (f->size == 0)
+	memset(f->work, 0, len * sizeof(float));
+      else
+	memset(f->work + 2 * (nhist + f->size), 0,
+	       (len - 2 * (nhist + f->size)) * sizeof(float));
+      f->size = nsamples;
+    }
+  return f->work + 2 * nhist;
+}
+
+/******************************************************************************/
+/*	fir_decimate							      */
+/******************************************************************************/
+int fir_decimate (struct FIRDEC *f, int nsamples, float *out)
+{
+  /* Filters the nsamples complex samples placed at fir_input, and writes
+     one complex output per factor samples to out.
+     returns the number of outputs
+  */
+  int m;
+
+  m = fir_count(f, nsamples);
+  fir_range(f, 0, m, out);
+  fir_advance(f, nsamples);
+  return m;
+}
+
+/******************************************************************************/
+/*	fir_count							      */
+/******************************************************************************/
+int fir_count (struct FIRDEC *f, int nsamples)
+{
+  /* returns the number of outputs completed by the nsamples complex
+     samples placed at fir_input
+  */
+  if (f->next >= nsamples)
+    return 0;
+  return (nsamples - f->next + f->factor - 1) / f->factor;
+}
+
+/******************************************************************************/
+/*	fir_range							      */
+/******************************************************************************/
+void fir_range (struct FIRDEC *f, int first, int last, float *out)
+{
+  /* Writes outputs first to last - 1 of the samples placed at fir_input
+     to the same places in out.  Each output reads only the shared work
+     array, so that separate ranges may be computed by separate threads.
+     FIR_LANES partial sums of each dot product are accumulated in
+     independent lanes, which the compiler vectorizes, and combined into
+     I and Q at the end.
+  */
+  float  acc[FIR_LANES];
+  float *w;
+  float  re, im;
+  int    m, i, l;
+
+  for (m = first; m < last; m++)
+    {
+      /* window of ntaps samples ending with sample next + m * factor */
+      w = f->work + 2 * (f->next + m * f->factor);
+      for (l = 0; l < FIR_LANES; l++)
+	acc[l] = 0;
+      for (i = 0; i < f->width; i += FIR_LANES)
+	for (l = 0; l < FIR_LANES; l++)
+	  acc[l] += f->taps[i+l] * w[i+l];
+      for (l = 0, re = 0, im = 0; l < FIR_LANES; l += 2)
+	{
+	  re += acc[l];
+	  im += acc[l+1];
+	}
+      out[2*m]   = re;
+      out[2*m+1] = im;
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	fir_advance							      */
+/******************************************************************************/
+void fir_advance (struct FIRDEC *f, int nsamples)
+{
+  /* moves past the nsamples complex samples placed at fir_input, once
+     all their outputs are computed, keeping the last ntaps - 1 as history
+  */
+  int nhist = f->ntaps - 1;
+
+  f->next += fir_count(f, nsamples) * f->factor - nsamples;
+  memmove(f->work, f->work + 2 * nsamples, 2 * nhist * sizeof(float));
+  return;
+}
+
+/******************************************************************************/
+/*	fir_close							      */
+/******************************************************************************/
+void fir_close (struct FIRDEC *f)
+{
+  free(f->taps);
+  free(f->work);
+  free(f);
+  return;
+}
+
+/******************************************************************************/
+/*	cic_open							      */
+/******************************************************************************/
+struct CICDEC *cic_open (int factor, int inbits)
+{
+  /* makes a cascaded integrator-comb decimator by factor, for integer
+     samples of inbits bits including the sign, of the highest order up
+     to CIC_MAXORDER whose register growth fits in 64 bits; the integrators
+     wrap around, which the combs undo
+     returns NULL if not even one stage fits, or on an allocation error
+  */
+  struct CICDEC *c;
+  int growth;
+
+  for (growth = 0; (1LL << growth) < factor; growth++)
+    ;
+
+  c = (struct CICDEC *) calloc(1, sizeof(struct CICDEC));
+  if (c == NULL)
+    return NULL;
+  c->factor = factor;
+  c->order  = (64 - inbits) / (growth ? growth : 1);
+  if (c->order > CIC_MAXORDER) c->order = CIC_MAXORDER;
+  if (c->order < 1)
+    {
+      free(c);
+      return NULL;
+    }
+  c->gain = 1 / pow((double) factor, c->order);
+  return c;
+}
+
+/******************************************************************************/
+/*	cic_decimate							      */
+/******************************************************************************/
+int cic_decimate (struct CICDEC *c, signed char *in, int nsamples, float *out)
+{
+  /* Decimates nsamples complex samples, signed bytes from in, and writes
+     one complex output per factor samples, with unit gain at zero
+     frequency, to out.  Each sample goes through order integrators; the
+     combs run at the output rate.
+     returns the number of outputs
+  */
+  unsigned long long *ii = c->integ[0], *iq = c->integ[1];
+  unsigned long long yi, yq, t;
+  double scale = c->gain;
+  long long xi, xq;
+  int    order = c->order;
+  int    j, s, m = 0;
+
+  for (j = 0; j < nsamples; j++)
+    {
+      xi = in[2*j];
+      xq = in[2*j+1];
+
+      /* integrators, modulo 2^64 */
+      ii[0] += (unsigned long long) xi;
+      iq[0] += (unsigned long long) xq;
+      for (s = 1; s < order; s++)
+	{
+	  ii[s] += ii[s-1];
+	  iq[s] += iq[s-1];
+	}
+      if (++c->phase < c->factor)
+	continue;
+      c->phase = 0;
+
+      /* combs */
+      yi = ii[order-1];
+      yq = iq[order-1];
+      for (s = 0; s < order; s++)
+	{
+	  t = yi - c->comb[0][s];
+	  c->comb[0][s] = yi;
+	  yi = t;
+	  t = yq - c->comb[1][s];
+	  c->comb[1][s] = yq;
+	  yq = t;
+	}
+      out[2*m]   = (long long) yi * scale;
+      out[2*m+1] = (long long) yq * scale;
+      m++;
+    }
+
+  return m;
+}
+
+/******************************************************************************/
+/*	fir_cic								      */
+/******************************************************************************/
+static struct FIRDEC *fir_cic (int order, int factor)
+{
+  /* makes a decimator by factor with the impulse response of a CIC
+     decimator of that order, order boxcars of factor samples in a row,
+     and unit gain at zero frequency; floats filtered this way keep their
+     precision at any amplitude, which the integers of a CIC would not
+     returns NULL on an allocation error
+  */
+  struct FIRDEC *f;
+  double *h;
+  int    ntaps = order * (factor - 1) + 1;
+  int    len, n, s;
+
+  if ((h = (double *) calloc(ntaps, sizeof(double))) == NULL)
+    return NULL;
+
+  /* each boxcar turns h into its means over factor taps, differences */
+  /* of its running sums */
+  h[0] = 1;
+  for (s = 0, len = 1; s < order; s++)
+    {
+      len += factor - 1;
+      for (n = 1; n < len; n++)
+	h[n] += h[n-1];
+      for (n = len - 1; n >= factor; n--)
+	h[n] -= h[n-factor];
+      for (n = 0; n < len; n++)
+	h[n] /= factor;
+    }
+
+  f = fir_make(ntaps, factor, h, 1);
+  free(h);
+  return f;
+}
+
+/******************************************************************************/
+/*	dec_open							      */
+/******************************************************************************/
+struct DECIMATOR *dec_open (int factor, int ntaps, double pass, double stop, double gain, int floatinput)
+{
+  /* Makes an anti-aliasing decimator by factor, with passband and stopband
+     edges pass and stop in units of the output rate and a gain of gain.
+     Factors below CIC_MIN_FACTOR, or not multiples of 4, use a single
+     filter of ntaps taps.  Larger ones use a CIC decimator by factor/4,
+     on the integer samples (or, for floatinput, a filter with the same
+     response, which keeps the precision of weak signals), followed by
+     a CIC_COMP_TAPS filter decimating by 2 that flattens the CIC passband,
+     and a final CIC_LAST_TAPS filter decimating by 2, a half-band filter
+     for edges symmetric about 0.5.
+     returns NULL on a bad design or allocation error
+  */
+  struct DECIMATOR *d;
+
+  d = (struct DECIMATOR *) calloc(1, sizeof(struct DECIMATOR));
+  if (d == NULL)
+    return NULL;
+  d->factor = factor;
+
+  if (factor < CIC_MIN_FACTOR || factor % 4 != 0)
+    {
+      if ((d->fir = fir_open(ntaps, factor, pass, stop, gain)) == NULL)
+	{
+	  free(d);
+	  return NULL;
+	}
+      return d;
+    }
+
+  /* the comp stage runs at 4 times the output rate; what lies beyond */
+  /* 2 - stop aliases beyond stop, where the last stage rejects it */
+  d->cic  = cic_open(factor / 4, 8);
+  d->box  = (d->cic && floatinput) ? fir_cic(d->cic->order, factor / 4) : NULL;
+  d->comp = d->cic ? fir_comp(CIC_COMP_TAPS, d->cic->order, factor / 4,
+			      pass / 4, (2 - stop) / 4, 1) : NULL;
+  d->fir  = fir_open(CIC_LAST_TAPS, 2, pass, stop, gain);
+  if (!d->cic || (floatinput && !d->box) || !d->comp || !d->fir)
+    {
+      dec_close(d);
+      return NULL;
+    }
+  return d;
+}
+
+/******************************************************************************/
+/*	dec_input							      */
+/******************************************************************************/
+float *dec_input (struct DECIMATOR *d, int nsamples)
+{
+  /* returns where the caller places the next nsamples complex float
+     samples for dec_decimate, in a decimator opened for floatinput if
+     it decimates in stages
+  */
+  if (d->cic == NULL)
+    return fir_input(d->fir, nsamples);
+  return fir_input(d->box, nsamples);
+}
+
+/******************************************************************************/
+/*	dec_decimate							      */
+/******************************************************************************/
+int dec_decimate (struct DECIMATOR *d, signed char *in, int nsamples, float *out)
+{
+  /* decimates nsamples complex samples, signed bytes from in, or floats
+     placed at dec_input if in is NULL, and writes the outputs to out
+     returns the number of outputs
+  */
+  float *x;
+  int    j, n;
+
+  if (d->cic == NULL)
+    {
+      if (in)
+	{
+	  x = fir_input(d->fir, nsamples);
+	  for (j = 0; j < 2 * nsamples; j++)
+	    x[j] = (float) in[j];
+	}
+      return fir_decimate(d->fir, nsamples, out);
+    }
+
+  /* the CIC writes straight into the input of the comp stage, */
+  /* and that into the input of the last stage */
+  x = fir_input(d->comp, nsamples / d->cic->factor + 1);
+  if (in)
+    n = cic_decimate(d->cic, in, nsamples, x);
+  else
+    n = fir_decimate(d->box, nsamples, x);
+  x = fir_input(d->fir, n / 2 + 1);
+  n = fir_decimate(d->comp, n, x);
+  return fir_decimate(d->fir, n, out);
+}
+
+/******************************************************************************/
+/*	dec_close							      */
+/******************************************************************************/
+void dec_close (struct DECIMATOR *d)
+{
+  if (d->fir) fir_close(d->fir);
+  if (d->comp) fir_close(d->comp);
+  if (d->box) fir_close(d->box);
+  free(d->cic);
+  free(d);
+  return;
+}
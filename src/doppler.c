@@ -0,0 +1,319 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doppler.h"
+
+/* compensation of a time-varying frequency offset, such as the Doppler */
+/* shift of an echo predicted from an ephemeris, during data decoding   */
+
+static double doppler_phase( struct DOPPLER *, double );
+static int    doppler_segment( struct DOPPLER *, double );
+
+/******************************************************************************/
+/*	doppler_open							      */
+/******************************************************************************/
+struct DOPPLER *doppler_open (char *modelfile, double fsamp, double start)
+{
+  /* reads a model of the signal frequency (Hz, relative to the band center)
+     versus time (s, from the first sample of the data file), either
+
+	poly t0 c0 c1 c2 ...	f(t) = c0 + c1 (t-t0) + c2 (t-t0)^2 + ...
+
+     on one line, or lines of
+
+	t f			linearly interpolated, constant beyond the ends
+
+     in increasing time order; lines starting with # are comments
+     fsamp is the sampling frequency (MHz) and start the time of the first
+     sample to be mixed (s)
+     returns NULL if the model cannot be read
+  */
+  struct DOPPLER *d;
+  FILE   *fp;
+  char    line[1024];
+  char   *tok;
+  double  t, f;
+  int     size = 0;
+  int     i;
+
+  if ((fp = fopen(modelfile, "r")) == NULL)
+    {
+      perror("doppler_open: model file open error");
+      return NULL;
+    }
+
+  d = (struct DOPPLER *) calloc(1, sizeof(struct DOPPLER));
+  if (d == NULL)
+    {
+      fclose(fp);
+      return NULL;
+    }
+
+  while (fgets(line, sizeof(line), fp) != NULL)
+    {
+      if ((tok = strtok(line, " \t\n")) == NULL || tok[0] == '#')
+	continue;
+
+      /* polynomial */
+      if (strcmp(tok, "poly") == 0)
+	{
+	  if ((tok = strtok(NULL, " \t\n")) == NULL || sscanf(tok, "%lf", &d->t0) != 1)
+	    break;
+	  while ((tok = strtok(NULL, " \t\n")) != NULL && d->npoly < 16 &&
+		 sscanf(tok, "%lf", &d->poly[d->npoly]) == 1)
+	    d->npoly++;
+	  break;
+	}
+
+      /* table entry */
+      if (sscanf(tok, "%lf", &t) != 1 || (tok = strtok(NULL, " \t\n")) == NULL ||
+	  sscanf(tok, "%lf", &f) != 1)
+	break;
+      if (d->ntab == size)
+	{
+	  size = size ? 2 * size : 1024;
+	  d->tabt = (double *) realloc(d->tabt, size * sizeof(double));
+	  d->tabf = (double *) realloc(d->tabf, size * sizeof(double));
+	  if (!d->tabt || !d->tabf)
+	    {
+	      fprintf(stderr,"Malloc error\n");
+	      exit(1);
+	    }
+	}
+      if (d->ntab > 0 && t <= d->tabt[d->ntab - 1])
+	{
+	  fprintf(stderr,"doppler_open: table times must increase\n");
+	  d->ntab = 0;
+	  break;
+	}
+      d->tabt[d->ntab] = t;
+      d->tabf[d->ntab] = f;
+      d->ntab++;
+    }
+  fclose(fp);
+
+  if (d->npoly == 0 && d->ntab == 0)
+    {
+      fprintf(stderr,"doppler_open: no frequency model in %s\n", modelfile);
+      doppler_close(d);
+      return NULL;
+    }
+
+  /* phase at the table entries, integrating the interpolated frequency */
+  if (d->ntab)
+    {
+      d->tabphase = (double *) malloc(d->ntab * sizeof(double));
+      if (!d->tabphase)
+	{
+	  fprintf(stderr,"Malloc error\n");
+	  exit(1);
+	}
+      d->tabphase[0] = 0;
+      for (i = 1; i < d->ntab; i++)
+	d->tabphase[i] = d->tabphase[i-1] +
+	  0.5 * (d->tabf[i-1] + d->tabf[i]) * (d->tabt[i] - d->tabt[i-1]);
+    }
+
+  d->tsamp = 1.0 / (fsamp * 1e6);
+  d->start = start;
+  return d;
+}
+
+/******************************************************************************/
+/*	doppler_const							      */
+/******************************************************************************/
+struct DOPPLER *doppler_const (double freq, double fsamp, double start)
+{
+  /* makes a model of a constant frequency freq (Hz, relative to the band
+     center), a numerically controlled oscillator that tunes the data to
+     freq; fsamp and start are as for doppler_open
+     returns NULL on an allocation error
+  */
+  struct DOPPLER *d;
+
+  d = (struct DOPPLER *) calloc(1, sizeof(struct DOPPLER));
+  if (d == NULL)
+    return NULL;
+  d->npoly   = 1;
+  d->poly[0] = freq;
+  d->tsamp   = 1.0 / (fsamp * 1e6);
+  d->start   = start;
+  return d;
+}
+
+/******************************************************************************/
+/*	doppler_offset							      */
+/******************************************************************************/
+void doppler_offset (struct DOPPLER *d, double freq)
+{
+  /* adds the constant frequency freq (Hz) to the model, for a signal
+     that follows the model about a frequency other than the band center
+  */
+  d->offset += freq;
+  return;
+}
+
+/******************************************************************************/
+/*	doppler_segment							      */
+/******************************************************************************/
+static int doppler_segment (struct DOPPLER *d, double t)
+{
+  /* returns i such that tabt[i] <= t < tabt[i+1], -1 before the table,
+     or ntab-1 after it; times mostly increase, so the search starts
+     from the last segment
+  */
+  if (t < d->tabt[0])
+    return -1;
+  if (d->seg < 0 || t < d->tabt[d->seg])
+    d->seg = 0;
+  while (d->seg < d->ntab - 1 && t >= d->tabt[d->seg + 1])
+    d->seg++;
+  return d->seg;
+}
+
+/******************************************************************************/
+/*	doppler_freq							      */
+/******************************************************************************/
+double doppler_freq (struct DOPPLER *d, double t)
+{
+  /* returns the model frequency at time t, Hz */
+  double x, f;
+  int    i;
+
+  if (d->npoly)
+    {
+      x = t - d->t0;
+      for (i = d->npoly - 1, f = 0; i >= 0; i--)
+	f = f * x + d->poly[i];
+      return f + d->offset;
+    }
+
+  i = doppler_segment(d, t);
+  if (i < 0)
+    return d->tabf[0] + d->offset;
+  if (i == d->ntab - 1)
+    return d->tabf[i] + d->offset;
+  return d->tabf[i] + (d->tabf[i+1] - d->tabf[i]) * (t - d->tabt[i]) / (d->tabt[i+1] - d->tabt[i]) +
+    d->offset;
+}
+
+/******************************************************************************/
+/*	doppler_phase							      */
+/******************************************************************************/
+static double doppler_phase (struct DOPPLER *d, double t)
+{
+  /* returns the integral of the model frequency up to time t, cycles,
+     from an arbitrary origin
+  */
+  double x, p, slope;
+  int    i;
+
+  if (d->npoly)
+    {
+      x = t - d->t0;
+      for (i = d->npoly - 1, p = 0; i >= 0; i--)
+	p = p * x + d->poly[i] / (i + 1);
+      return p * x + d->offset * t;
+    }
+
+  i = doppler_segment(d, t);
+  if (i < 0)
+    return d->tabf[0] * (t - d->tabt[0]) + d->offset * t;
+  x = t - d->tabt[i];
+  if (i == d->ntab - 1)
+    return d->tabphase[i] + d->tabf[i] * x + d->offset * t;
+  slope = (d->tabf[i+1] - d->tabf[i]) / (d->tabt[i+1] - d->tabt[i]);
+  return d->tabphase[i] + d->tabf[i] * x + 0.5 * slope * x * x + d->offset * t;
+}
+
+/******************************************************************************/
+/*	doppler_mix							      */
+/******************************************************************************/
+void doppler_mix (struct DOPPLER *d, float *data, int nsamples)
+{
+  /* Moves the model frequency of the nsamples complex samples in data to
+     zero by multiplying them with exp(-2 pi i phase(t)), and advances the
+     time.  The phase is evaluated exactly every DOPPLER_BLOCK samples and
+     follows a quadratic (linear frequency) in between, matching the
+     exact phase at both ends of the block.  Within a block, DOPPLER_LANES
+     interleaved rotators are advanced by complex multiplications, which
+     the compiler vectorizes, instead of computing a sine and cosine for
+     every sample.
+  */
+  float  zr[DOPPLER_LANES], zi[DOPPLER_LANES];	/* rotators */
+  float  wr[DOPPLER_LANES], wi[DOPPLER_LANES];	/* rotator steps */
+  float  cr, ci;		/* step of rotator steps */
+  float  dr, di, tr;
+  double p0, p1;		/* phase at ends of block, cycles */
+  double a, b, q;		/* phase a + b m + q m^2 at sample m, cycles */
+  double phi;
+  double t;			/* time of first sample of block, s */
+  int    V = DOPPLER_LANES;
+  int    n, m, l;
+
+  for (; nsamples > 0; nsamples -= n, data += 2*n)
+    {
+      n = (nsamples < DOPPLER_BLOCK) ? nsamples : DOPPLER_BLOCK;
+
+      t  = d->start + d->count * d->tsamp;
+      p0 = doppler_phase(d, t);
+      p1 = doppler_phase(d, t + n * d->tsamp);
+      a  = p0 - floor(p0);
+      b  = doppler_freq(d, t) * d->tsamp;
+      q  = (p1 - p0 - b * n) / ((double) n * n);
+
+      for (l = 0; l < V; l++)
+	{
+	  phi = -2 * M_PI * (a + b * l + q * l * l);
+	  zr[l] = cos(phi);
+	  zi[l] = sin(phi);
+	  phi = -2 * M_PI * (b * V + q * (2.0 * l * V + V * V));
+	  wr[l] = cos(phi);
+	  wi[l] = sin(phi);
+	}
+      phi = -2 * M_PI * 2 * q * V * V;
+      cr = cos(phi);
+      ci = sin(phi);
+
+      for (m = 0; m + V <= n; m += V)
+	{
+	  for (l = 0; l < V; l++)
+	    {
+	      dr = data[2*(m+l)];
+	      di = data[2*(m+l)+1];
+	      data[2*(m+l)]   = dr * zr[l] - di * zi[l];
+	      data[2*(m+l)+1] = dr * zi[l] + di * zr[l];
+	      tr    = zr[l] * wr[l] - zi[l] * wi[l];
+	      zi[l] = zr[l] * wi[l] + zi[l] * wr[l];
+	      zr[l] = tr;
+	      tr    = wr[l] * cr - wi[l] * ci;
+	      wi[l] = wr[l] * ci + wi[l] * cr;
+	      wr[l] = tr;
+	    }
+	}
+      for (l = 0; m + l < n; l++)
+	{
+	  dr = data[2*(m+l)];
+	  di = data[2*(m+l)+1];
+	  data[2*(m+l)]   = dr * zr[l] - di * zi[l];
+	  data[2*(m+l)+1] = dr * zi[l] + di * zr[l];
+	}
+
+      d->count += n;
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	doppler_close							      */
+/******************************************************************************/
+void doppler_close (struct DOPPLER *d)
+{
+  free(d->tabt);
+  free(d->tabf);
+  free(d->tabphase);
+  free(d);
+  return;
+}
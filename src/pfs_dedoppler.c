@@ -0,0 +1,538 @@
+/*******************************************************************************
+*  program pfs_dedoppler
+*  $Id$
+*  This programs searches a time series of spectra obtained with the pfs_fft
+*  program (-t option) for signals drifting linearly in frequency
+*  It uses the Taylor tree algorithm to compute the summed power along all
+*  linear drift paths in O(N T log T) operations for N channels and T spectra
+*  Input data are assumed to be four byte floating point numbers, or a
+*  file of spectra written with the pfs_fft -e option
+*
+*  usage:
+*  	pfs_dedoppler -f sampling frequency (MHz)
+*              [-r frequency resolution (Hz)]
+*              [-n number of transforms summed in each spectrum]
+*              [-T number of spectra per search block (power of 2)]
+*              [-D maximum drift rate (Hz/s)]
+*              [-s minimum SNR of candidates]
+*              [-k number of candidates to output]
+*              [-o outfile] [infile]
+*
+*  input:
+*       the input parameters are typed in as command line arguments
+*       the -f argument specifies the sampling frequency of the transformed
+*                       data in MHz, i.e. the pfs_fft -f value divided by
+*                       the pfs_fft -d value
+*	the -r argument specifies the fft frequency resolution in Hz
+*	the -n argument specifies the pfs_fft -n value
+*       the -T argument specifies how many consecutive spectra are searched
+*                       together; the series is processed one block at a
+*                       time, so its length is not limited by memory
+*       the -D argument limits the drift rates that are reported
+*       the -s argument specifies the SNR threshold for candidates
+*       the -k argument specifies how many of the strongest candidates
+*                       are kept
+*       the input file may be a pipe; it is stdin if omitted or given as -
+*       a file of spectra written by pfs_fft -e supplies the resolution,
+*                       integration time, and frequency range itself, and
+*                       -f, -r, and -n are then ignored; candidate times
+*                       are counted from the start of the data file
+*
+*  output:
+*	the -o option identifies the output file, stdout is default
+*       one line per candidate: start time of block (s), frequency at the
+*       start of the block (Hz), drift rate (Hz/s), and SNR
+*
+*******************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "streamfile.h"
+#include "spectra.h"
+#include "candidate.h"
+
+/* revision control variable */
+static char const rcsid[] =
+"$Id$";
+
+FILE   *fpoutput;		/* pointer to output file */
+struct STREAMFILE *input;	/* buffered input file */
+
+char   *outfile;		/* output file name */
+char   *infile;		        /* input file name */
+
+char	command_line[512];	/* command line assembled by processargs */
+
+#define DEDOP_CHUNK 65536	/* channels searched at once */
+
+void processargs();
+void open_file();
+void copy_cmd_line();
+void normalize_spectrum(float *data, int len);
+float *taylor_tree(float *a, float *b, int ntime, int width);
+void search_block(float *block, float *work1, float *work2, float *best, int *bestdrift,
+		  int fftlen, int ntime, int maxshift);
+
+int main(int argc, char *argv[])
+{
+  float *block;		/* ntime spectra of fftlen channels */
+  float *work1,*work2;	/* Taylor tree work arrays */
+  float *best;		/* best SNR over drift rates, for each channel */
+  int   *bestdrift;	/* drift of best SNR, for each channel */
+  struct CANDIDATE *heap; /* strongest candidates */
+  struct CANDIDATE cand;
+  long inbufsize;	/* size of one block */
+  struct SPECFILE *spec; /* input file of spectra, if any */
+
+  double fsamp;		/* sampling frequency, MHz */
+  double freqres;	/* frequency resolution, Hz */
+  double freqmin;	/* frequency of first channel, Hz */
+  double tint;		/* integration time of one spectrum, s */
+  double maxdrift;	/* maximum drift rate, Hz/s */
+  double driftres;	/* drift rate resolution, Hz/s */
+  float snrmin;		/* candidate threshold */
+  long long sum;	/* number of transforms in each spectrum */
+  int fftlen;		/* transform length, complex samples */
+  int ntime;		/* number of spectra per block */
+  int maxshift;		/* maximum drift, channels per block */
+  int width;		/* width of Taylor tree work arrays */
+  int maxcand;		/* maximum number of candidates */
+  int ncand = 0;	/* number of candidates kept */
+  long long nabove = 0;	/* number of candidates above threshold */
+  int nblocks = 0;	/* number of blocks searched */
+  long nread = 0;	/* bytes read */
+  int i,j;
+
+  /* get the command line arguments */
+  processargs(argc,argv,&infile,&outfile,&fsamp,&freqres,&sum,&ntime,&maxdrift,&snrmin,&maxcand);
+
+  /* save the command line */
+  copy_cmd_line(argc,argv,command_line);
+
+  /* open output file, stdout default */
+  open_file(outfile,&fpoutput);
+
+  /* open file input, stdin default, mapping a file of spectra */
+  if ((spec = spec_open(infile)) == NULL && (input = stream_open(infile, 0)) == NULL)
+    {
+      perror("open input file");
+      exit(1);
+    }
+
+  /* compute search parameters */
+  if (spec)
+    {
+      freqres  = spec->hdr->freqres;
+      fftlen   = spec->hdr->nchan;
+      freqmin  = spec->hdr->freqmin;
+      tint     = spec->hdr->tint;
+    }
+  else
+    {
+      fftlen   = (int) rint(fsamp * 1e6 / freqres);
+      freqmin  = -(fftlen/2) * freqres;
+      tint     = sum / freqres;
+    }
+  driftres = freqres / ((ntime - 1) * tint);
+  maxshift = ntime - 1;
+  if (maxdrift != 0 && maxdrift < maxshift * driftres)
+    maxshift = (int) floor(maxdrift / driftres);
+  inbufsize = (long) ntime * fftlen * sizeof(float);
+
+  fprintf(stderr,"\n%s\n\n",command_line);
+  fprintf(stderr,"FFT length                     : %d\n",fftlen);
+  fprintf(stderr,"Frequency resolution           : %e Hz\n",freqres);
+  fprintf(stderr,"Integration time per spectrum  : %e s\n",tint);
+  fprintf(stderr,"Spectra per search block       : %d\n",ntime);
+  fprintf(stderr,"Drift rate resolution          : %e Hz/s\n",driftres);
+  fprintf(stderr,"Maximum drift rate             : %e Hz/s\n",maxshift * driftres);
+  fprintf(stderr,"Data required for one block    : %ld bytes\n",inbufsize);
+  fprintf(stderr,"\n");
+
+  /* allocate storage */
+  block     = (float *) malloc(inbufsize);
+  width     = (fftlen < DEDOP_CHUNK ? fftlen : DEDOP_CHUNK) + ntime;
+  work1     = (float *) malloc((long) ntime * width * sizeof(float));
+  work2     = (float *) malloc((long) ntime * width * sizeof(float));
+  best      = (float *) malloc(fftlen * sizeof(float));
+  bestdrift = (int *)   malloc(fftlen * sizeof(int));
+  heap      = (struct CANDIDATE *) malloc(maxcand * sizeof(struct CANDIDATE));
+  if (!block || !work1 || !work2 || !best || !bestdrift || !heap)
+    {
+      fprintf(stderr,"Malloc error\n");
+      exit(1);
+    }
+
+  /* search one block of spectra at a time until EOF */
+  while (1)
+    {
+      if (spec)
+	{
+	  if ((long long) (nblocks + 1) * ntime > spec->nspectra)
+	    break;
+	  for (i = 0; i < ntime; i++)
+	    memcpy(&block[(long) i * fftlen], spec_data(spec, (long long) nblocks * ntime + i),
+		   fftlen * sizeof(float));
+	}
+      else if ((nread = stream_read(input, (char *) block, inbufsize)) != inbufsize)
+	break;
+
+      for (i = 0; i < ntime; i++)
+	normalize_spectrum(&block[(long) i * fftlen], fftlen);
+
+      search_block(block, work1, work2, best, bestdrift, fftlen, ntime, maxshift);
+
+      /* keep the strongest channel of each group of channels above threshold */
+      for (i = 0; i < fftlen; i = j)
+	{
+	  if (best[i] < snrmin)
+	    {
+	      j = i + 1;
+	      continue;
+	    }
+	  cand.snr = best[i];
+	  cand.freq = freqmin + i * freqres;
+	  cand.drift = bestdrift[i] * driftres;
+	  for (j = i + 1; j < fftlen && best[j] >= snrmin; j++)
+	    if (best[j] > cand.snr)
+	      {
+		cand.snr = best[j];
+		cand.freq = freqmin + j * freqres;
+		cand.drift = bestdrift[j] * driftres;
+	      }
+	  cand.time = spec ? spec_time(spec, (long long) nblocks * ntime) : nblocks * ntime * tint;
+	  cand_push(heap, &ncand, maxcand, &cand);
+	  nabove++;
+	}
+      nblocks++;
+    }
+  if (nread > 0)
+    fprintf(stderr,"Ignoring %ld bytes after last complete block\n",nread);
+  if (spec && spec->nspectra > (long long) nblocks * ntime)
+    fprintf(stderr,"Ignoring %lld spectra after last complete block\n",spec->nspectra - (long long) nblocks * ntime);
+
+  fprintf(stderr,"Searched %d blocks\n",nblocks);
+  fprintf(stderr,"Found %lld candidates above SNR %.1f, writing %d\n",nabove,snrmin,ncand);
+
+  /* write candidates, strongest first */
+  cand_sort(heap, ncand);
+  fprintf(fpoutput,"#   time (s)       freq (Hz)    drift (Hz/s)      SNR\n");
+  for (i = 0; i < ncand; i++)
+    fprintf(fpoutput,"%12.6f % .6e % .6e %8.2f\n",heap[i].time,heap[i].freq,heap[i].drift,heap[i].snr);
+
+  return 0;
+}
+
+/******************************************************************************/
+/*	normalize_spectrum						      */
+/******************************************************************************/
+void normalize_spectrum(float *data, int len)
+{
+  /* scales the spectrum to zero mean and unit rms, excluding points
+     deviating by more than 3.5 sigmas from the computation of mean and rms
+  */
+  double mean,mean1;
+  double var,var1;
+  double sigma,sigma1;
+  int    i,n;
+
+  mean1 = var1 = 0;
+  for (i = 0; i < len; i++)
+    {
+      mean1 += data[i];
+      var1  += data[i] * data[i];
+    }
+  mean1  = mean1 / len;
+  var1   = var1 / len;
+  sigma1 = sqrt(var1 - mean1 * mean1);
+
+  mean = var = 0;
+  n = 0;
+  for (i = 0; i < len; i++)
+    {
+      if (sigma1 > 0 && fabs((data[i] - mean1)/sigma1) > 3.5)
+	continue;
+      mean += data[i];
+      var  += data[i] * data[i];
+      n++;
+    }
+  mean  = mean / n;
+  var   = var / n;
+  sigma = sqrt(var - mean * mean);
+
+  for (i = 0; i < len; i++)
+    data[i] = (sigma > 0) ? (data[i] - mean) / sigma : 0;
+
+  return;
+}
+
+/******************************************************************************/
+/*	taylor_tree							      */
+/******************************************************************************/
+float *taylor_tree(float *a, float *b, int ntime, int width)
+{
+  /* Taylor tree dedispersion of ntime rows of width channels in array a.
+     On return, row d of the returned array (a or b) holds, for each start
+     channel x, the sum along the path that drifts by d channels between
+     the first and last rows.  Sub-trees of n rows are combined pairwise:
+     drift d over 2n rows is drift d/2 over the first n rows followed by
+     drift d/2 over the last n rows, offset by (d+1)/2 channels.
+     Channels beyond width contribute zero.
+  */
+  float *lo, *up, *out, *tmp;
+  int    n, c, d, s, x;
+
+  for (n = 1; n < ntime; n *= 2)
+    {
+      for (c = 0; c < ntime; c += 2*n)
+	for (d = 0; d < 2*n; d++)
+	  {
+	    lo  = &a[(long) (c + (d>>1)) * width];
+	    up  = &a[(long) (c + n + (d>>1)) * width];
+	    out = &b[(long) (c + d) * width];
+	    s   = (d + 1) >> 1;
+	    for (x = 0; x < width - s; x++)
+	      out[x] = lo[x] + up[x + s];
+	    for (; x < width; x++)
+	      out[x] = lo[x];
+	  }
+      tmp = a;
+      a = b;
+      b = tmp;
+    }
+  return a;
+}
+
+/******************************************************************************/
+/*	search_block							      */
+/******************************************************************************/
+void search_block(float *block, float *work1, float *work2, float *best, int *bestdrift,
+		  int fftlen, int ntime, int maxshift)
+{
+  /* computes, for each start channel, the best SNR over all positive and
+     negative drifts of up to maxshift channels per block, and that drift
+     (channels per block, signed)
+     channels are processed in chunks of DEDOP_CHUNK, overlapped by ntime
+     channels so that every path lies within a chunk
+     negative drifts are searched by reversing the frequency axis
+  */
+  float *sums;		/* Taylor tree output */
+  float  snr;
+  float  norm = 1.0 / sqrt((double) ntime);
+  int    w;		/* number of start channels in chunk */
+  int    width;		/* chunk width including overlap */
+  int    c0;		/* first channel of chunk */
+  int    dir;		/* +1 for positive drifts, -1 for negative drifts */
+  int    t, x, d, f;
+
+  for (f = 0; f < fftlen; f++)
+    {
+      best[f] = -1e30;
+      bestdrift[f] = 0;
+    }
+
+  for (dir = 1; dir >= -1; dir -= 2)
+    for (c0 = 0; c0 < fftlen; c0 += DEDOP_CHUNK)
+      {
+	w = (fftlen - c0 < DEDOP_CHUNK) ? fftlen - c0 : DEDOP_CHUNK;
+	width = w + ntime;
+
+	/* copy chunk, reversed for negative drifts, zero padded beyond band */
+	for (t = 0; t < ntime; t++)
+	  for (x = 0; x < width; x++)
+	    {
+	      f = (dir > 0) ? c0 + x : fftlen - 1 - (c0 + x);
+	      work1[(long) t * width + x] = (c0 + x < fftlen) ? block[(long) t * fftlen + f] : 0;
+	    }
+
+	sums = taylor_tree(work1, work2, ntime, width);
+
+	for (d = 0; d <= maxshift; d++)
+	  for (x = 0; x < w; x++)
+	    {
+	      snr = sums[(long) d * width + x] * norm;
+	      f = (dir > 0) ? c0 + x : fftlen - 1 - (c0 + x);
+	      if (snr > best[f])
+		{
+		  best[f] = snr;
+		  bestdrift[f] = dir * d;
+		}
+	    }
+      }
+
+  return;
+}
+
+/******************************************************************************/
+/*	processargs							      */
+/******************************************************************************/
+void	processargs(argc,argv,infile,outfile,fsamp,freqres,sum,ntime,maxdrift,snrmin,maxcand)
+int	argc;
+char	**argv;			 /* command line arguements */
+char	**infile;		 /* input file name */
+char	**outfile;		 /* output file name */
+double  *fsamp;
+double  *freqres;
+long long *sum;
+int     *ntime;
+double  *maxdrift;
+float   *snrmin;
+int     *maxcand;
+{
+  /* function to process a programs input command line.
+     This is a template which has been customised for the pfs_dedoppler program:
+	- the outfile name is set from the -o option
+	- the infile name is set from the 1st unoptioned argument
+  */
+
+  int getopt();		/* c lib function returns next opt*/
+  extern char *optarg; 	/* if arg with option, this pts to it*/
+  extern int optind;	/* after call, ind into argv for next*/
+  extern int opterr;    /* if 0, getopt won't output err mesg*/
+
+  char *myoptions = "f:r:n:T:D:s:k:o:"; 	 /* options to search for :=> argument*/
+  char *USAGE1="pfs_dedoppler -f sampling frequency (MHz) [-r frequency resolution (Hz)] [-n number of transforms summed in each spectrum] [-T number of spectra per search block (power of 2)] [-D maximum drift rate (Hz/s)] [-s minimum SNR] [-k number of candidates] [-o outfile] [infile (- for stdin)]";
+  int  c;			 /* option letter returned by getopt  */
+  int  arg_count = 1;		 /* optioned argument count */
+
+  /* default parameters */
+  opterr = 0;			 /* turn off there message */
+  *infile  = "-";		 /* initialise to stdin, stdout */
+  *outfile = "-";
+
+  *fsamp = 0;
+  *freqres = 1;
+  *sum = 1;
+  *ntime = 64;
+  *maxdrift = 0;		/* default is all drifts up to one channel per spectrum */
+  *snrmin = 10;
+  *maxcand = 100;
+
+  /* loop over all the options in list */
+  while ((c = getopt(argc,argv,myoptions)) != -1)
+  {
+    switch (c)
+      {
+      case 'o':
+	*outfile = optarg;	/* output file name */
+	arg_count += 2;		/* two command line arguments */
+	break;
+
+      case 'f':
+	sscanf(optarg,"%lf",fsamp);
+	arg_count += 2;
+	break;
+
+      case 'r':
+	sscanf(optarg,"%lf",freqres);
+	arg_count += 2;
+	break;
+
+      case 'n':
+	sscanf(optarg,"%lld",sum);
+	arg_count += 2;
+	break;
+
+      case 'T':
+	sscanf(optarg,"%d",ntime);
+	arg_count += 2;
+	break;
+
+      case 'D':
+	sscanf(optarg,"%lf",maxdrift);
+	arg_count += 2;
+	break;
+
+      case 's':
+	sscanf(optarg,"%f",snrmin);
+	arg_count += 2;
+	break;
+
+      case 'k':
+	sscanf(optarg,"%d",maxcand);
+	arg_count += 2;
+	break;
+
+      case '?':			 /*if not in myoptions, getopt rets ? */
+	goto errout;
+	break;
+      }
+  }
+
+  if (arg_count < argc)		 /* 1st non-optioned param is infile */
+    *infile = argv[arg_count];
+
+  /* must specify a valid sampling frequency, unless the input records it */
+  if (*fsamp == 0 && !spec_probe(*infile))
+    {
+      fprintf(stderr,"Must specify sampling frequency\n");
+      goto errout;
+    }
+  /* block length must be a power of 2 */
+  if (*ntime < 2 || (*ntime & (*ntime - 1)) != 0)
+    {
+      fprintf(stderr,"Number of spectra per block must be a power of 2\n");
+      goto errout;
+    }
+  if (*sum < 1 || *maxcand < 1 || *maxdrift < 0) goto errout;
+
+  return;
+
+  /* here if illegal option or argument */
+  errout: fprintf(stderr,"%s\n",rcsid);
+          fprintf(stderr,"Usage: %s\n",USAGE1);
+	  exit(1);
+}
+
+/******************************************************************************/
+/*	open file    							      */
+/******************************************************************************/
+void	open_file(outfile,fpoutput)
+char	*outfile;		/* output file name */
+FILE    **fpoutput;		/* pointer to output file */
+{
+  /* opens the output file, stdout is default */
+  if (outfile[0] == '-')
+    *fpoutput=stdout;
+  else
+    {
+      *fpoutput=fopen(outfile,"w");
+      if (*fpoutput == NULL)
+	{
+	  perror("open_files: output file open error");
+	  exit(1);
+	}
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	copy_cmd_line    						      */
+/******************************************************************************/
+void	copy_cmd_line(argc,argv,command_line)
+int	argc;
+char	**argv;			/* command line arguements */
+char	command_line[];		/* command line parameters in single string */
+{
+  /* copys the command line parameters in argv to the single string
+     command line
+  */
+  int	i;
+
+  strcpy(command_line,argv[0]);
+  strcat(command_line," ");
+
+  for (i=1; i<argc; i++)
+  {
+    strcat(command_line,argv[i]);
+    strcat(command_line," ");
+  }
+
+  return;
+}
@@ -3,7 +3,8 @@
 *  $Id: pfs_dehop.c,v 1.7 2009/11/16 19:11:45 jlm Exp $
 *  This programs dehops spectra obtained with the pfs_fft program
 *  It expects a time series of one or more ffts per dwell time
-*  Input data are assumed to be four byte floating point numbers
+*  Input data are assumed to be four byte floating point numbers, or a
+*  file of spectra written with the pfs_fft -e option
 *
 *  usage:
 *  	pfs_dehop
@@ -22,6 +23,9 @@
 *	the -r argument specifies the fft frequency resolution in Hz
 *       the -h argument specifies the hop parameters:
 *		starting frequency, frequency increment, number of hops
+*	a file of spectra written by pfs_fft -e supplies the sampling
+*		frequency, resolution, and integration time itself, and
+*		-f and -r are then ignored
 *
 *  output:
 *	the -o option identifies the output file, stdout is default
@@ -63,6 +67,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "unpack.h"
+#include "spectra.h"
 
 /* revision control variable */
 static char const rcsid[] = 
@@ -86,6 +91,9 @@ void cmplxmul(float *in1, float *in2, float *out, int len);
 int main(int argc, char *argv[])
 {
   float *fftbuf;
+  float *spectrum;	/* spectrum being dehopped */
+  struct SPECFILE *spec; /* input file of spectra, if any */
+  long long nspec = 0;	/* number of spectra read from it */
   float *total;
   float *baseline;
   int inbufsize;
@@ -115,17 +123,35 @@ int main(int argc, char *argv[])
   /* open output file, stdout default */
   open_file(outfile,&fpoutput);
 
-  /* open file input */
-  open_flags = O_RDONLY;
-  if((fdinput = open(infile, open_flags)) < 0 )
-    perror("open input file");
-
+  /* open file input, mapping a file of spectra */
+  if ((spec = spec_open(infile)) == NULL)
+    {
+      open_flags = O_RDONLY;
+      if((fdinput = open(infile, open_flags)) < 0 )
+	perror("open input file");
+    }
 
   /* compute transform parameters */
-  fftlen     = (int) rint(fsamp * 1e3 / freqres);
-  shift      = (int) rint(df    * 1e3 / freqres);
-  fftsperhop = (int) rint(dwell * freqres);
-  init       = (int) rint(fftlen / 2.0 + f0 * 1e3 / freqres);
+  if (spec)
+    {
+      freqres    = spec->hdr->freqres;
+      fftlen     = spec->hdr->nchan;
+      shift      = (int) rint(df    * 1e3 / freqres);
+      fftsperhop = (int) rint(dwell / spec->hdr->tint);
+      init       = (int) rint((f0 * 1e3 - spec->hdr->freqmin) / freqres);
+    }
+  else
+    {
+      fftlen     = (int) rint(fsamp * 1e3 / freqres);
+      shift      = (int) rint(df    * 1e3 / freqres);
+      fftsperhop = (int) rint(dwell * freqres);
+      init       = (int) rint(fftlen / 2.0 + f0 * 1e3 / freqres);
+    }
+  if (init - shift / 2 < 0 || init - shift / 2 + hops * shift > fftlen)
+    {
+      fprintf(stderr,"Hops extend beyond the spectra\n");
+      exit(1);
+    }
   inbufsize = fftlen * sizeof(float); 
   outbufsize = shift * sizeof(float);
 
@@ -161,8 +187,15 @@ int main(int argc, char *argv[])
       for (i = 0; i < hops; i++)
 	for (j = 0; j < fftsperhop; j++)
 	  {
-	    if (inbufsize != read(fdinput, fftbuf, inbufsize))
+	    if (spec)
+	      {
+		if ((spectrum = spec_data(spec, nspec++)) == NULL)
+		  goto write;
+	      }
+	    else if (inbufsize != read(fdinput, fftbuf, inbufsize))
 	      goto write;
+	    else
+	      spectrum = fftbuf;
 
 	    /* now we split the data array in hop-sized chunks */
 	    /* if data  (k==i), sum in array total */
@@ -180,11 +213,11 @@ int main(int argc, char *argv[])
 		/* sum data */
 		if (k == i)
 		  for (m = 0; m < shift; m++)
-		    total[m]    += fftbuf[l+m];
+		    total[m]    += spectrum[l+m];
 		/* sum noise */
 		else
 		  for (m = 0; m < shift; m++)
-		    baseline[m] += fftbuf[l+m];
+		    baseline[m] += spectrum[l+m];
 	      }
 	  }
     }
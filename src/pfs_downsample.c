@@ -13,6 +13,15 @@
 *                      [-c channel] 
 *                      [-i swap I/Q] 
 *                      [-s number of complex samples to skip] 
+*                      [-X file of signal frequency versus time to compensate]
+*                      [-C center frequency (Hz)]
+*                      [-B output bandwidth (Hz)]
+*                      [-F sampling frequency (MHz), required with -X, -C, -B]
+*                      [-L number of filter taps]
+*                      [-p passband,stopband edges (units of output rate)]
+*                      [-T number of threads]
+*                      [-P channel,factor,outfile ...]
+*                      [-W single|dual|sum (integrate power)]
 *                      [-o outfile] [infile]
 *
 *  input:
@@ -20,6 +29,54 @@
 *	the -m option specifies the data acquisition mode
 *	the -d argument specifies the downsampling factor
 *       the -c argument specifies which channel (1 or 2) to process
+*       the -X argument names a polynomial or tabulated model of the signal
+*               frequency (Hz) versus time from the start of the file (s),
+*               such as a Doppler prediction; the signal is mixed to zero
+*               frequency before downsampling (see doppler.c)
+*       the -C argument tunes to a subband centered that many Hz from the
+*               band center, mixing it to zero frequency with a numerically
+*               controlled oscillator before filtering and downsampling;
+*               with -X, the model is taken about that frequency
+*       the -B argument replaces -d by the bandwidth of the subband, which
+*               sets the downsampling factor so that it fits within the
+*               passband of -p (-2 pass to 2 pass of the output rate), and
+*               selects filtering with 8 taps per unit of factor unless -L
+*               is given; -C -B make a digital downconverter that writes
+*               only the subband
+*       the -L argument replaces the sum of consecutive samples by a lowpass
+*               filter of that many taps, evaluated once per output sample
+*               and continued across buffers, with passband and stopband
+*               edges given by -p in units of the output sampling rate
+*               (default 0.4,0.6); its gain matches that of the sum, and
+*               about 8 taps per unit of downsampling factor give good
+*               alias rejection; factors of 64 and more that are multiples
+*               of 4 are decimated in stages instead, by a CIC decimator on
+*               the integer samples, a short filter compensating its
+*               passband, and a half-band filter, and -L only selects
+*               filtering (see decimate.c)
+*       the -T argument specifies the number of threads decimating each
+*               buffer, default one per processor; the buffer is split
+*               into segments of whole output samples, and filters read
+*               the samples before their segment from the same buffer or
+*               the history kept from the last one; Doppler mixing and
+*               the CIC stage of large factors run in one thread
+*       the -P argument adds a product, the channel downsampled by the
+*               factor into the output file, and replaces -c, -d and -o;
+*               it may be repeated to make several products from one pass
+*               over the data, for either channel of modes 5 to 7, and a
+*               product whose factor is a multiple of that of another of
+*               the same channel downsamples its outputs further; with
+*               -P, -L gives the taps per unit of the factor of each
+*               filter
+*       the -W argument integrates power instead of downsampling the
+*               samples: it writes the sum of I^2 + Q^2, less the dc
+*               offsets of -I and -Q, over each downsampling factor
+*               samples, as floats, without scaling; single does so for
+*               the channel of -c, and, for modes 5 to 7, dual writes
+*               the powers of both channels interleaved and sum their
+*               total; 8-bit samples are summed in integers, which the
+*               compiler vectorizes, and the threads of -T share each
+*               buffer
 *
 *  output:
 *	the -o option identifies the output file, stdout is default
@@ -136,13 +193,14 @@
 #include <pthread.h>
 
 #include "unpack.h"
+#include "doppler.h"
+#include "decimate.h"
 
 /* revision control variable */
 static char const rcsid[] = 
 "$Id: pfs_downsample.c,v 3.16 2014/01/07 02:27:21 jlm Exp $";
 
 int	fdinput;		/* file descriptor for input file */ 
-int	fdoutput;		/* file descriptor to output file */
 
 char	command_line[200];	/* command line assembled by processargs */
 char	header[40];		/* data file name header */
@@ -162,27 +220,106 @@ float   wordstoskip=0.0;/* number of 4-byte words to skip */
 float   bytestoskip=0.0;/* number of bytes to skip */
 float   remainingbytestoskip=0.0;/* number of remaining bytes to skip after lseek call */
 
+int	ntaps = 0;	/* taps of the anti-aliasing filter, 0 to sum samples */
+float	fpass, fstop;	/* passband and stopband edges, units of output rate */
+
 int	mode;		/* data acquisition mode */
 int     chan;		/* channel to process (1 or 2) for dual pol data */
 int	bufsize;	/* input buffer size */
-float   scale; 		/* scaling factor to fit in a byte */
 float	dcoffi,dcoffq;	/* dc offsets */
+char   *modelfile;	/* file of signal frequency versus time */
+double  center;		/* frequency tuned to zero, Hz */
+double  bandwidth;	/* bandwidth of the output, Hz, or 0 */
+double  fsamp;		/* sampling frequency, MHz */
+struct DOPPLER *dop[2];	/* frequency model of each channel, if any */
+float  *mixbuf[2];	/* samples of each channel mixed at the full sampling rate */
+
+/* each product is one channel downsampled by one factor into one file; */
+/* a product whose factor is a multiple of that of another product of */
+/* the same channel downsamples the outputs of that one */
+#define MAXPRODUCTS 16
+
+struct PRODUCT {
+  int     chan;			/* channel to process (1 or 2) */
+  int     factor;		/* factor by which to downsample */
+  char   *outfile;		/* output file name */
+  int     fd;			/* file descriptor to output file */
+  int     from;			/* product downsampled further, or -1 */
+  int     step;			/* factor relative to that product */
+  float   scale;		/* scaling factor to fit in a byte */
+  struct DECIMATOR *dec;	/* anti-aliasing decimator, if any */
+  float  *raw;			/* downsampled samples of a buffer, before scaling */
+  int     nraw;			/* number of them */
+};
+
+struct PRODUCT products[MAXPRODUCTS];
+int	nproducts = 0;
+int	nchans;			/* channels in the data */
+
+/* power integration instead of downsampling */
+#define POWER_SINGLE 1		/* the power of one channel */
+#define POWER_DUAL   2		/* the powers of both channels, interleaved */
+#define POWER_SUM    3		/* the total power of both channels */
+#define POWER_CHUNK  16384	/* samples summed in lanes at a time */
+#define POWER_LANES  16		/* independent partial sums, an even number */
+
+int	power = 0;		/* power integration, or 0 */
+int	chanused[2];		/* channels that some product needs */
+
+/* the downsampler splits each buffer among nthreads threads, itself and */
+/* nthreads - 1 workers, by ranges of output samples */
+int	nthreads;		/* threads decimating a buffer, 0 for one per processor */
+pthread_t *workers;
+int	*wnum;			/* worker numbers */
+int	*nclip;			/* samples clipped by each thread */
+struct PRODUCT *seg;		/* product being made */
+char	*segpol[2];		/* channels whose power is integrated */
+char	*segin;			/* first input sample of the buffer */
+float	*segsrc;		/* mixed samples or outputs of another product, or NULL */
+int	segout;			/* output samples of the buffer */
+int	segsum;			/* output samples summed rather than filtered */
+float	*segy;			/* float outputs */
+signed char *segx;		/* byte outputs */
+long long njobs   = 0;	/* buffers handed to the workers */
+int	nbusy     = 0;	/* workers still decimating the last one */
+int	workend   = 0;	/* no more buffers */
+pthread_mutex_t worklock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  workcond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t  donecond = PTHREAD_COND_INITIALIZER;
+
+/* the reader, decoder and downsampler threads pass buffers through a ring */
+#define NBUFS 4			/* number of buffers in the ring */
 
-/* for thread ID */
 pthread_t tid[3];
 
 struct jdata {
-    char    *bfrthr1;
-    char    *bfrthr2;
-    char   *chnthr1;
-    char   *chnthr2;
-    int	    bytesread;	/* number of bytes read from input file */
+    unsigned char *buffer;	/* packed data */
+    char   *channel[2];	/* unpacked data of each channel */
+    int	    bytesread;		/* number of bytes read from input file */
 };
 
+struct jdata ring[NBUFS];
+long long nread    = 0;	/* buffers read, advanced by the reader only */
+long long ndecoded = 0;	/* buffers unpacked, advanced by the decoder only */
+long long ndone    = 0;	/* buffers downsampled, advanced by the downsampler only */
+int	readend    = 0;	/* the reader has read the last buffer */
+int	decodeend  = 0;	/* the decoder has unpacked the last buffer */
+pthread_mutex_t ringlock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  ringcond = PTHREAD_COND_INITIALIZER;
 
 void *read_buf(void *rdata);
 void *proc_buf(void *pdata);
 void *iq_downsample (void *pdata);
+int  read_one(struct jdata *rbuf);
+void unpack_one(struct jdata *pbuf);
+void downsample_one(struct jdata *pbuf);
+void downsample_product(struct PRODUCT *p, char *inbuf, int nin, int skip);
+void integrate_power(struct PRODUCT *p, struct jdata *pbuf, int nin, int skip);
+void *segment_worker(void *wdata);
+void run_segments(void);
+void segment_one(int w);
+void power_one(int w);
+double detect(char *x, int n);
 
 void processargs();
 void copy_cmd_line();
@@ -190,21 +327,20 @@ void copy_cmd_line();
 
 int main(int argc, char *argv[])
 {
-  unsigned char *buffer1, *buffer2;		/* buffer for packed data */
-  char *channel1,*channel2;	/* buffer for unpacked data */
   float maxunpack;	/* maximum unpacked value from libunpack */
   float maxvalue;	/* maximum achievable value by downsampling */
   float fudge;		/* scale fudge factor */
   long samplestoskip;	/* number of complex samples to skip */
-  int i;
+  int unit;		/* multiple of all factors */
+  int pertap;		/* -L gives taps per unit of factor */
+  int i, c, q;
+  struct PRODUCT *p;
 
   char   *outfile;	/* output file name */
   char   *infile;	/* input file name */
 
-  struct jdata cntlbuf;
-
   /* get the command line arguments and open the files */
-  processargs(argc,argv,&infile,&outfile,&mode,&downsample,&chan,&dcoffi,&dcoffq,&fudge,&samplestoskip);
+  processargs(argc,argv,&infile,&outfile,&mode,&downsample,&chan,&dcoffi,&dcoffq,&fudge,&samplestoskip,&modelfile,&fsamp,&ntaps,&fpass,&fstop,&nthreads,&center,&bandwidth);
 
   /* save the command line */
   copy_cmd_line(argc,argv,command_line);
@@ -223,6 +359,74 @@ int main(int argc, char *argv[])
     case 32:  smpwd = 0.5; maxunpack = +255; break;
     default: fprintf(stderr,"Invalid mode\n"); exit(1);
     }
+  nchans = (mode >= 5 && mode <= 7) ? 2 : 1;
+
+  /* the bandwidth sets the factor, with the passband -fpass to fpass */
+  /* of the output rate covering it */
+  if (bandwidth > 0)
+    {
+      downsample = (int) floor(2 * fpass * fsamp * 1e6 / bandwidth);
+      if (downsample < 1)
+	{
+	  fprintf(stderr,"Bandwidth %g Hz exceeds that of the data\n", bandwidth);
+	  exit(1);
+	}
+      if (ntaps == 0)
+	ntaps = 8 * downsample;
+      if (verbose) fprintf(stderr,"Output bandwidth %g Hz centered at %g Hz, downsampling by %d to %g Hz\n",
+			   bandwidth, center, downsample, fsamp * 1e6 / downsample);
+    }
+
+  /* -c, -d and -o make a single product */
+  pertap = (nproducts > 0);
+  if (nproducts == 0)
+    {
+      products[0].chan    = chan;
+      products[0].factor  = downsample;
+      products[0].outfile = outfile;
+      nproducts = 1;
+    }
+
+  /* both channels are decoded for their powers */
+  if (power == POWER_DUAL || power == POWER_SUM)
+    {
+      if (nchans != 2)
+	{
+	  fprintf(stderr,"Powers of both channels require mode 5, 6 or 7\n");
+	  exit(1);
+	}
+      chanused[0] = chanused[1] = 1;
+    }
+
+  /* smaller factors first, each product taking the outputs of the */
+  /* largest smaller factor dividing its own, of the same channel */
+  for (i = 1; i < nproducts; i++)
+    for (q = i; q > 0 && products[q].factor < products[q-1].factor; q--)
+      {
+	struct PRODUCT t = products[q];
+	products[q] = products[q-1];
+	products[q-1] = t;
+      }
+  unit = 1;
+  for (i = 0; i < nproducts; i++)
+    {
+      p = &products[i];
+      c = (nchans == 2) ? p->chan - 1 : 0;
+      p->from = -1;
+      p->step = p->factor;
+      for (q = 0; q < i; q++)
+	if (((nchans == 2) ? products[q].chan - 1 : 0) == c &&
+	    products[q].factor < p->factor && p->factor % products[q].factor == 0)
+	  {
+	    p->from = q;
+	    p->step = p->factor / products[q].factor;
+	  }
+      if (p->from < 0)
+	chanused[c] = 1;
+      for (q = unit; q % p->factor != 0; q += unit)
+	;
+      unit = q;
+    }
 
   /* open input file */
   open_rflags = O_RDONLY;
@@ -243,7 +447,7 @@ int main(int argc, char *argv[])
   if (filestat.st_size % 4 != 0)
     if (verbose) fprintf(stderr,"Warning: file size %lld is not a multiple of 4\n", 
 			 (long long int) filestat.st_size);
-  if (filestat.st_size % downsample != 0)
+  if (filestat.st_size % unit != 0)
     if (verbose) fprintf(stderr,"Warning: file size %lld not a multiple of dwnsmplng factor\n",
 			 (long long int) filestat.st_size);
 
@@ -273,38 +477,54 @@ int main(int argc, char *argv[])
     if ((filestat.st_size - (int) bytestoskip) % 4 != 0)
       if (verbose) fprintf(stderr,"Warning: file size %lld with %.1f byte skip not a multiple of 4\n",
 			   (long long int) filestat.st_size, bytestoskip);
-    if ((filestat.st_size - (int) bytestoskip) % downsample != 0)
+    if ((filestat.st_size - (int) bytestoskip) % unit != 0)
       if (verbose) fprintf(stderr,"Warning: file size %lld with %.1f byte skip not a multiple of dwnsmplng factor\n", 
 			   (long long int) filestat.st_size, bytestoskip);
   }
 
-  /* open output file, stdout is default */
+  /* open output files, stdout is default */
   open_wflags = O_RDWR | O_CREAT | O_TRUNC;
-  if (outfile[0] == '-') {
-     fdoutput=STDOUT_FILENO;
-  } else if ((fdoutput = open(outfile, open_wflags, 0660)) < 0 )
-  {
-     perror("open input file");
-     exit(1);
-  }
+  for (i = 0; i < nproducts; i++)
+    {
+      p = &products[i];
+      if (p->outfile[0] == '-') {
+	p->fd = STDOUT_FILENO;
+      } else if ((p->fd = open(p->outfile, open_wflags, 0660)) < 0 )
+      {
+	perror("open output file");
+	exit(1);
+      }
+    }
 
   /* compute dynamic range parameters */
-  if (verbose) fprintf(stderr,"Downsampling file of size %d kB by %d\n", 
-		       (int) (filestat.st_size / 1000), downsample);
-  maxvalue = maxunpack * sqrt(downsample);
-  scale = fudge * 0.25 * 128 / maxvalue;
-
-  if (!floats && maxvalue > 255)
+  for (i = 0; i < nproducts; i++)
     {
-      fprintf(stderr,"You may have a dynamic range problem\n");
-      fprintf(stderr,"Turning clipping mode on so you can detect clipping instances\n");
-      clipping = 1;
+      p = &products[i];
+      if (verbose && nproducts == 1)
+	fprintf(stderr,"Downsampling file of size %d kB by %d\n", 
+		(int) (filestat.st_size / 1000), p->factor);
+      else if (verbose && p->from < 0)
+	fprintf(stderr,"Downsampling channel %d of file of size %d kB by %d into %s\n", 
+		p->chan, (int) (filestat.st_size / 1000), p->factor, p->outfile);
+      else if (verbose)
+	fprintf(stderr,"Downsampling channel %d by %d from the output by %d into %s\n", 
+		p->chan, p->factor, products[p->from].factor, p->outfile);
+      maxvalue = maxunpack * sqrt(p->factor);
+      p->scale = fudge * 0.25 * 128 / maxvalue;
+
+      if (!floats && maxvalue > 255 && !clipping)
+	{
+	  fprintf(stderr,"You may have a dynamic range problem\n");
+	  fprintf(stderr,"Turning clipping mode on so you can detect clipping instances\n");
+	  clipping = 1;
+	}
     }
 
   /* compute buffer size */
-  /* we need a multiple of the downsampling factor, or order 1 MB */
+  /* we need a multiple of the downsampling factors, or order 1 MB */
   /* make it 4 MB as we were getting warnings when downsampling by 16 */
-  bufsize = (int) rint(1000000.0/downsample) * downsample * 4;
+  bufsize = (int) rint(1000000.0/unit) * unit * 4;
+  if (bufsize == 0) bufsize = unit * 4;
   /* but the buffer size must be smaller than the file size */
   if (bufsize > (filestat.st_size - (int) bytestoskip)) 
     {
@@ -317,138 +537,187 @@ int main(int argc, char *argv[])
 		       (int) floor((filestat.st_size - bytestoskip) / bufsize), bufsize);
   
   /* allocate storage */
-  nsamples = bufsize * smpwd / 4;
-  buffer1 = (unsigned char *) malloc(bufsize);
-  buffer2 = (unsigned char *) malloc(bufsize);
-
   /* for mode 32, data buffers are transferred as float. Others use char unpack */
-  if (mode == 32) {
-    channel1 = (char *) malloc(bufsize);
-    channel2 = (char *) malloc(bufsize);
-  } else {
-    channel1 = (char *) malloc(2 * bufsize * smpwd / 4 * sizeof(char));
-    channel2 = (char *) malloc(2 * bufsize * smpwd / 4 * sizeof(char));
-  }
-
-  if (!channel1 || !channel2 || !buffer1 || !buffer2) 
-    fprintf(stderr,"Malloc error\n");
-
-
-  if (nsamples % downsample != 0)
-    fprintf(stderr,"Warning: # samples per buffer %d, downsampling factor %d\n",
-	    nsamples,downsample);
-
-    i = 1;
-
-    /* read 1st buffer */
-    cntlbuf.bfrthr1 = buffer1;
-    cntlbuf.chnthr1 = channel1;
-    pthread_create (&tid[0], NULL, read_buf, (void *)&cntlbuf);
-    pthread_join (tid[0], NULL);
-
-    /* read 2nd buffer & process 1st unpacking */
-    cntlbuf.bfrthr1 = buffer2;
-    cntlbuf.chnthr1 = channel2;
-    cntlbuf.bfrthr2 = buffer1;
-    cntlbuf.chnthr2 = channel1;
-    pthread_create (&tid[1], NULL, proc_buf, (void *)&cntlbuf);
-    pthread_create (&tid[0], NULL, read_buf, (void *)&cntlbuf);
-    pthread_join (tid[0], NULL);
-    pthread_join (tid[1], NULL);
-
-    while (1) {
-	/* buffer assignment for parallel processing */
-	if (i++ % 2) {
-	    cntlbuf.bfrthr1 = buffer1;
-	    cntlbuf.chnthr1 = channel1;
-	    cntlbuf.bfrthr2 = buffer2;
-	    cntlbuf.chnthr2 = channel2;
-	} else {
-	    cntlbuf.bfrthr1 = buffer2;
-	    cntlbuf.chnthr1 = channel2;
-	    cntlbuf.bfrthr2 = buffer1;
-	    cntlbuf.chnthr2 = channel1;
+  nsamples = bufsize * smpwd / 4;
+  for (i = 0; i < NBUFS; i++)
+    {
+      ring[i].buffer = (unsigned char *) malloc(bufsize);
+      if (!ring[i].buffer)
+	{
+	  fprintf(stderr,"Malloc error\n");
+	  exit(1);
 	}
-
-        /* read buffer, process unpacking & downsample */
-        pthread_create (&tid[1], NULL, proc_buf, (void *)&cntlbuf);
-        pthread_create (&tid[0], NULL, read_buf, (void *)&cntlbuf);
-        pthread_create (&tid[2], NULL, iq_downsample, (void *)&cntlbuf);
-
-        pthread_join (tid[1], NULL);
-        pthread_join (tid[0], NULL);
-        pthread_join (tid[2], NULL);
-
-	/* last buffer? */
-	if (cntlbuf.bytesread != bufsize) {
-	  break;
+      for (c = 0; c < nchans; c++)
+	{
+	  if (!chanused[c])
+	    continue;
+	  if (mode == 32)
+	    ring[i].channel[c] = (char *) malloc(bufsize);
+	  else
+	    ring[i].channel[c] = (char *) malloc(2 * bufsize * smpwd / 4 * sizeof(char));
+	  if (!ring[i].channel[c])
+	    {
+	      fprintf(stderr,"Malloc error\n");
+	      exit(1);
+	    }
 	}
     }
 
-    /* last buffer == empty buffer? */
-    if (cntlbuf.bytesread != 0) {
-	if (i++ % 2) {
-	    cntlbuf.bfrthr1 = buffer1;
-	    cntlbuf.chnthr1 = channel1;
-	    cntlbuf.bfrthr2 = buffer2;
-	    cntlbuf.chnthr2 = channel2;
-	} else {
-	    cntlbuf.bfrthr1 = buffer2;
-	    cntlbuf.chnthr1 = channel2;
-	    cntlbuf.bfrthr2 = buffer1;
-	    cntlbuf.chnthr2 = channel1;
-	}
-
-        /* process unpacking & downsample */
-        pthread_create (&tid[1], NULL, proc_buf, (void *)&cntlbuf);
-        pthread_create (&tid[2], NULL, iq_downsample, (void *)&cntlbuf);
-
-        pthread_join (tid[1], NULL);
-        pthread_join (tid[2], NULL);
+  /* frequency model, or the oscillator tuning to the center frequency, */
+  /* starts at the first sample kept */
+  if (modelfile[0] != '-' || center != 0)
+    for (c = 0; c < nchans; c++)
+      {
+	if (!chanused[c])
+	  continue;
+	if (modelfile[0] == '-')
+	  dop[c] = doppler_const(center, fsamp, samplestoskip / (fsamp * 1e6));
+	else if ((dop[c] = doppler_open(modelfile, fsamp, samplestoskip / (fsamp * 1e6))) != NULL)
+	  doppler_offset(dop[c], center);
+	if (dop[c] == NULL)
+	  exit(1);
+	if ((mixbuf[c] = (float *) malloc(2 * nsamples * sizeof(float))) == NULL)
+	  {
+	    fprintf(stderr,"Malloc error\n");
+	    exit(1);
+	  }
+      }
 
-        /* prepare to handle small size for the last buffer */
-	bufsize = cntlbuf.bytesread;
+  for (i = 0; i < nproducts; i++)
+    {
+      p = &products[i];
+      c = (nchans == 2) ? p->chan - 1 : 0;
+
+      /* anti-aliasing filter, with the gain of a sum of factor samples; */
+      /* the outputs of another product are divided by its factor first */
+      if (ntaps)
+	{
+	  if ((p->dec = dec_open(p->step, pertap ? ntaps * p->step : ntaps, fpass, fstop, p->factor,
+				 mode == 32 || dop[c] || p->from >= 0)) == NULL)
+	    {
+	      fprintf(stderr,"Cannot design filter of %d taps, passband %g, stopband %g\n",
+		      pertap ? ntaps * p->step : ntaps, fpass, fstop);
+	      exit(1);
+	    }
+	  if (verbose && p->dec->cic)
+	    fprintf(stderr,"Filtering with CIC of order %d by %d, then %d and %d taps by 2, passband %g, stopband %g (output rate)\n",
+		    p->dec->cic->order, p->dec->cic->factor, CIC_COMP_TAPS, CIC_LAST_TAPS, fpass, fstop);
+	  else if (verbose)
+	    fprintf(stderr,"Filtering with %d taps, passband %g, stopband %g (output rate)\n",
+		    pertap ? ntaps * p->step : ntaps, fpass, fstop);
+	}
+      if ((p->raw = (float *) malloc(2 * (nsamples / p->factor + 2) * sizeof(float))) == NULL)
+	{
+	  fprintf(stderr,"Malloc error\n");
+	  exit(1);
+	}
 
-	nsamples = (int) rint(bufsize * smpwd / 4.0);
-	if (verbose) fprintf(stderr,"And one buffer of size %d\n", bufsize);
+      if (nsamples % p->factor != 0)
+	fprintf(stderr,"Warning: # samples per buffer %d, downsampling factor %d\n",
+		nsamples,p->factor);
     }
 
-    /* only process last buffer read size */
-    if (i++ % 2) {
-	cntlbuf.bfrthr1 = buffer1;
-	cntlbuf.chnthr1 = channel1;
-    } else {
-	cntlbuf.bfrthr1 = buffer2;
-	cntlbuf.chnthr1 = channel2;
+  /* workers sharing the decimation of each buffer, for the whole file */
+  if (nthreads == 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 1) nthreads = 1;
+  workers = (pthread_t *) malloc(nthreads * sizeof(pthread_t));
+  wnum    = (int *) malloc(nthreads * sizeof(int));
+  nclip   = (int *) malloc(nthreads * sizeof(int));
+  if (!workers || !wnum || !nclip)
+    {
+      fprintf(stderr,"Malloc error\n");
+      exit(1);
+    }
+  if (verbose) fprintf(stderr,"Decimating each buffer in %d threads\n", nthreads);
+  for (i = 1; i < nthreads; i++)
+    {
+      wnum[i] = i;
+      pthread_create (&workers[i], NULL, segment_worker, (void *) &wnum[i]);
     }
-	
-    /* process downsample only */
-    pthread_create (&tid[2], NULL, iq_downsample, (void *)&cntlbuf);
-    pthread_join (tid[2], NULL);
-
 
-    /* clean up */
-    free (buffer1);
-    free (buffer2);
-    free (channel1);
-    free (channel2);
+  /* read, unpack and downsample in three threads that last for the whole */
+  /* file; each stage waits for buffers from the previous one, and the */
+  /* reader for a free buffer, so that at most NBUFS are in flight */
+  pthread_create (&tid[0], NULL, read_buf, NULL);
+  pthread_create (&tid[1], NULL, proc_buf, NULL);
+  pthread_create (&tid[2], NULL, iq_downsample, NULL);
+  pthread_join (tid[0], NULL);
+  pthread_join (tid[1], NULL);
+  pthread_join (tid[2], NULL);
+
+  pthread_mutex_lock (&worklock);
+  workend = 1;
+  pthread_cond_broadcast (&workcond);
+  pthread_mutex_unlock (&worklock);
+  for (i = 1; i < nthreads; i++)
+    pthread_join (workers[i], NULL);
+
+  /* clean up */
+  for (i = 0; i < NBUFS; i++) {
+    free (ring[i].buffer);
+    free (ring[i].channel[0]);
+    free (ring[i].channel[1]);
+  }
 
-    close (fdinput);
-    close (fdoutput);
+  close (fdinput);
+  for (i = 0; i < nproducts; i++)
+    close (products[i].fd);
 
   return 0;
 }
 
 
-void *read_buf (void *rdata) {
-    struct jdata *rbuf = (struct jdata *)rdata;
+/******************************************************************************/
+/*	read_buf							      */
+/******************************************************************************/
+void *read_buf (void *rdata)
+{
+  /* reader thread: fills the ring buffers in turn until a short read */
+  struct jdata *rbuf;
+  long long n;
+  int last;
+
+  for (n = 0; ; n++)
+    {
+      /* wait for the downsampler to release the buffer */
+      pthread_mutex_lock (&ringlock);
+      while (n - ndone >= NBUFS)
+	pthread_cond_wait (&ringcond, &ringlock);
+      pthread_mutex_unlock (&ringlock);
+
+      rbuf = &ring[n % NBUFS];
+      last = read_one (rbuf);
+
+      /* an empty last buffer is not passed on */
+      pthread_mutex_lock (&ringlock);
+      if (rbuf->bytesread > 0)
+	nread = n + 1;
+      readend = last;
+      pthread_cond_broadcast (&ringcond);
+      pthread_mutex_unlock (&ringlock);
+      if (last)
+	break;
+    }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/*	read_one							      */
+/******************************************************************************/
+int read_one (struct jdata *rbuf)
+{
+  /* reads one buffer, continuing with the next data file with -a
+     returns 1 if it is the last buffer
+  */
     int datasz;
     char infile[80];
 
     /* read one buffer */
-    if        ((rbuf->bytesread = read (fdinput, rbuf->bfrthr1, bufsize)) == -1) {
+    if        ((rbuf->bytesread = read (fdinput, rbuf->buffer, bufsize)) == -1) {
 	perror("read");
-	return NULL;
+	rbuf->bytesread = 0;
+	return 1;
     /* 03/05/04 SWJ - need more data from next data file? */
     } else if (rbuf->bytesread != bufsize && allfiles == 1) {
 	close (fdinput);
@@ -460,62 +729,97 @@ void *read_buf (void *rdata) {
 	/* we assume that if the file with the next extension does not exist, 
 	   we have reached the end */
 	if ((fdinput = open(infile, open_rflags)) < 0) {
-	    return NULL;
+	    return 1;
 	} else if (fstat (fdinput, &filestat) < 0) {
 	    perror("fstat");
-	    return NULL;
+	    return 1;
 	}
 
 	/* make up the data buffer */
-    	if ((datasz = read (fdinput, rbuf->bfrthr1 + rbuf->bytesread, bufsize - rbuf->bytesread )) == -1) {
+    	if ((datasz = read (fdinput, rbuf->buffer + rbuf->bytesread, bufsize - rbuf->bytesread )) == -1) {
 	    perror ("read");
-	    return NULL;
+	    return 1;
 	} else {
 	    rbuf->bytesread = datasz + rbuf->bytesread;
 	} 
     }
+
+    return rbuf->bytesread != bufsize;
 }
 
+/******************************************************************************/
+/*	proc_buf							      */
+/******************************************************************************/
+void *proc_buf (void *pdata)
+{
+  /* decoder thread: unpacks the buffers read */
+  long long n;
+
+  for (n = 0; ; n++)
+    {
+      pthread_mutex_lock (&ringlock);
+      while (n >= nread && !readend)
+	pthread_cond_wait (&ringcond, &ringlock);
+      if (n >= nread)
+	{
+	  decodeend = 1;
+	  pthread_cond_broadcast (&ringcond);
+	  pthread_mutex_unlock (&ringlock);
+	  break;
+	}
+      pthread_mutex_unlock (&ringlock);
 
-void *proc_buf (void *pdata) {
-    struct jdata *pbuf = (struct jdata *)pdata;
+      unpack_one (&ring[n % NBUFS]);
+
+      pthread_mutex_lock (&ringlock);
+      ndecoded = n + 1;
+      pthread_cond_broadcast (&ringcond);
+      pthread_mutex_unlock (&ringlock);
+    }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/*	unpack_one							      */
+/******************************************************************************/
+void unpack_one (struct jdata *pbuf)
+{
+    /* whole words, as a short buffer may end within one */
+    int nbytes = (pbuf->bytesread + 3) / 4 * 4;
+    char *rcp = pbuf->channel[0];	/* channel 1, or the only one */
+    char *lcp = pbuf->channel[1];	/* channel 2 */
+
+    if (nbytes > bufsize) nbytes = bufsize;
+
+    /* unpack the channels needed */
 
-    /* unpack and downsample */
     switch (mode)
       {
         case 1:
-          unpack_pfs_2c2b (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
+          unpack_pfs_2c2b (pbuf->buffer, rcp, nbytes);
           break;
         case 2:
-          unpack_pfs_2c4b (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
+          unpack_pfs_2c4b (pbuf->buffer, rcp, nbytes);
           break;
         case 3:
-          unpack_pfs_2c8b (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
+          unpack_pfs_2c8b (pbuf->buffer, rcp, nbytes);
           break;
         case 5:
-          if (chan == 2) {
-	    unpack_pfs_4c2b_lcp (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
-          } else {
-            unpack_pfs_4c2b_rcp (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
-          }
+          if (lcp) unpack_pfs_4c2b_lcp (pbuf->buffer, lcp, nbytes);
+          if (rcp) unpack_pfs_4c2b_rcp (pbuf->buffer, rcp, nbytes);
           break;
         case 6:
-          if (chan == 2) {
-            unpack_pfs_4c4b_lcp (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
-          } else {
-            unpack_pfs_4c4b_rcp (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
-	  }
+          if (lcp) unpack_pfs_4c4b_lcp (pbuf->buffer, lcp, nbytes);
+          if (rcp) unpack_pfs_4c4b_rcp (pbuf->buffer, rcp, nbytes);
           break;
         case 7:
-	  if (chan == 2) {
-	    unpack_pfs_4c8b_lcp (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
-	  } else {
-	    unpack_pfs_4c8b_rcp (pbuf->bfrthr2, pbuf->chnthr2, bufsize);
-	  }
+	  if (lcp) unpack_pfs_4c8b_lcp (pbuf->buffer, lcp, nbytes);
+	  if (rcp) unpack_pfs_4c8b_rcp (pbuf->buffer, rcp, nbytes);
           break;
         case 8:
         case 32:
-          memcpy (pbuf->chnthr2, pbuf->bfrthr2, bufsize);
+          memcpy (rcp, pbuf->buffer, nbytes);
           break;
         default: fprintf(stderr,"mode not implemented yet\n"); exit(1);
       }
@@ -525,65 +829,336 @@ void *proc_buf (void *pdata) {
 /******************************************************************************/
 /*	iq_downsample							      */
 /******************************************************************************/
+void *iq_downsample (void *pdata)
+{
+  /* downsampler thread: downsamples and writes the buffers unpacked, */
+  /* then releases them to the reader */
+  long long n;
+
+  for (n = 0; ; n++)
+    {
+      pthread_mutex_lock (&ringlock);
+      while (n >= ndecoded && !decodeend)
+	pthread_cond_wait (&ringcond, &ringlock);
+      if (n >= ndecoded)
+	{
+	  pthread_mutex_unlock (&ringlock);
+	  break;
+	}
+      pthread_mutex_unlock (&ringlock);
 
-void *iq_downsample (void *pdata) 
+      /* the last buffer may be short */
+      if (ring[n % NBUFS].bytesread != bufsize)
+	{
+	  nsamples = (int) rint(ring[n % NBUFS].bytesread * smpwd / 4.0);
+	  if (verbose) fprintf(stderr,"And one buffer of size %d\n", ring[n % NBUFS].bytesread);
+	}
+      downsample_one (&ring[n % NBUFS]);
+
+      pthread_mutex_lock (&ringlock);
+      ndone = n + 1;
+      pthread_cond_broadcast (&ringcond);
+      pthread_mutex_unlock (&ringlock);
+    }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/*	downsample_one							      */
+/******************************************************************************/
+void downsample_one (struct jdata *pbuf)
 {
-  struct jdata *pbuf = (struct jdata *)pdata;
+  int j, c, p;
+  int skip = 0;		/* samples to skip */
+  int nin;		/* samples to downsample */
+  char *inbuf;
 
-  char	*inbuf  = (char *) pbuf->chnthr1; 
-  float iq[2];
+  /* 03/05/04 SWJ - need to skip 1st sample ?  */
+  if (remainingbytestoskip > 0.0) {
+    skip = remainingbytestoskip;
+    if (verbose) fprintf(stderr,"***** Skipping %d extra sample ***** \n", skip);
 
-  /* accumulator larger enough to not cause overflow on all downsampled data */
-  int	is  = 0,   qs  = 0;	/* is, qs  : char  accumulators for I & Q */
-  float isf = 0.0, qsf = 0.0;	/* isf, qsf: float accumulators for I & Q */
+    /* byte skipping on begining of data segment only */
+    remainingbytestoskip = 0.0;
+  }
+  nin = nsamples - skip;
 
-  signed char *x;
-  float *y;
+  /* compensate the frequency model of each channel at the full sampling rate */
+  for (c = 0; c < nchans; c++)
+    if (dop[c])
+      {
+	/* skip I & Q */
+	inbuf = pbuf->channel[c] + 2 * skip;
+	if (mode == 32)
+	  memcpy (mixbuf[c], inbuf, 8 * nin);
+	else
+	  for (j = 0; j < 2 * nin; j++)
+	    mixbuf[c][j] = (float) inbuf[j];
+	doppler_mix (dop[c], mixbuf[c], nin);
+      }
 
-  int j, k=0, l=0;
-  int nbytes = 2 * nsamples / downsample;
+  /* or its power is integrated */
+  if (power)
+    {
+      integrate_power (&products[0], pbuf, nin, skip);
+      return;
+    }
+
+  /* each decoded buffer goes to every product of its channel, */
+  /* smaller factors first */
+  for (p = 0; p < nproducts; p++)
+    {
+      c = (nchans == 2) ? products[p].chan - 1 : 0;
+      downsample_product (&products[p], pbuf->channel[c] + 2 * skip, nin, skip);
+    }
+
+  return;
+}
+
+/******************************************************************************/
+/*	downsample_product						      */
+/******************************************************************************/
+void downsample_product (struct PRODUCT *p, char *inbuf, int nin, int skip)
+{
+  /* downsamples the nin samples of a buffer from inbuf, or the outputs */
+  /* of the product p is made from, and writes them to its file */
+  struct PRODUCT *from = NULL;
+  float *work;		/* samples to filter */
+
+  int j, w;
+  int nbytes = 2 * nsamples / p->factor;
   int nclipped = 0;
   int bcnt;
+  int l;
 
-  float iscale = dcoffi * downsample * scale;
-  float qscale = dcoffq * downsample * scale;
-
+  /* filtering may complete one more sample than summing */
   if (floats) 
-    y = (float *) malloc(4 * nbytes);
+    segy = (float *) malloc(4 * (nbytes + 4));
+  else
+    segx = (signed char *) malloc(nbytes + 4);
+
+  /* the stages that carry state from sample to sample run here, and */
+  /* the threads then filter or sum and format their ranges of outputs */
+  seg    = p;
+  segin  = inbuf;
+  segsrc = mixbuf[(nchans == 2) ? p->chan - 1 : 0];
+  segsum = 0;
+  if (p->from >= 0)
+    {
+      from   = &products[p->from];
+      segsrc = from->raw;
+      nin    = from->nraw;
+      bcnt   = nin / p->step;
+    }
   else
-    x = (signed char *) malloc(nbytes);
+    bcnt = nsamples / p->factor - skip;
 
-  bcnt = nsamples / downsample;
+  /* filter and decimate the samples, or the outputs of another product */
+  /* divided by its factor */
+  if (p->dec && p->dec->cic && !segsrc && mode != 32)
+    segout = dec_decimate (p->dec, (signed char *) inbuf, nin, p->raw);
+  else if (p->dec)
+  {
+    work = dec_input (p->dec, nin);
+    if (from)
+      for (j = 0; j < 2 * nin; j++)
+	work[j] = segsrc[j] / from->factor;
+    else if (segsrc)
+      memcpy (work, segsrc, 8 * nin);
+    else if (mode == 32)
+      memcpy (work, inbuf, 8 * nin);
+    else
+      for (j = 0; j < 2 * nin; j++)
+	work[j] = (float) inbuf[j];
+    if (p->dec->cic)
+      segout = dec_decimate (p->dec, NULL, nin, p->raw);
+    else
+      segout = fir_count (p->dec->fir, nin);
+  }
 
-  /* 03/05/04 SWJ - need to skip 1st sample ?  */
-  if (remainingbytestoskip > 0.0) {
-    j = remainingbytestoskip;
-    if (verbose) fprintf(stderr,"***** Skipping %d extra sample ***** \n", j);
-    while (j > 0) {
-      bcnt --;
-      j --;
-
-      /* skip I & Q */
-      *inbuf++;
-      *inbuf++;
+  /* or sum them */
+  else
+  {
+    segout = (bcnt > 0) ? bcnt : 0;
+    segsum = 1;
+  }
+
+  run_segments ();
+  if (p->dec && !p->dec->cic)
+    fir_advance (p->dec->fir, nin);
+  p->nraw = segout;
+
+  for (w = 0; w < nthreads; w++)
+    nclipped += nclip[w];
+  l = 2 * segout;
+
+  /* 03/05/04 SWJ  if (l != nbytes) fprintf(stderr,"oops\n"); */
+  
+  /* print diagnostics */
+  if (clipping && !floats) 
+    fprintf(stderr,"this buffer: output samples %d nclipped %d\n",
+	    nbytes,nclipped); 
+
+  /* write it out */
+  /* SWJ - replaced all nbytes with l */
+  if (floats)
+    {
+      if (write(p->fd, segy, 4 * l) != 4 * l) perror ("Write floats");
+      free(segy);
+    }
+  else
+    {
+      if (write(p->fd, segx, l) != l) perror ("Write bytes");
+      free(segx);
     }
 
-    /* byte skipping on begining of data segment only */
-    remainingbytestoskip = 0.0;
-  }
+  return;
+}    
+
+
+/******************************************************************************/
+/*	integrate_power							      */
+/******************************************************************************/
+void integrate_power (struct PRODUCT *p, struct jdata *pbuf, int nin, int skip)
+{
+  /* integrates the power of the nin samples of a buffer over factor */
+  /* samples and writes it to the file of product p */
+  int l;
+
+  seg    = p;
+  segout = nin / p->factor;
+  if (power == POWER_SINGLE)
+    segpol[0] = pbuf->channel[(nchans == 2) ? p->chan - 1 : 0] + 2 * skip;
+  else
+    {
+      segpol[0] = pbuf->channel[0] + 2 * skip;
+      segpol[1] = pbuf->channel[1] + 2 * skip;
+    }
+  l = (power == POWER_DUAL) ? 2 * segout : segout;
+  if ((segy = (float *) malloc(4 * (l + 1))) == NULL)
+    {
+      fprintf(stderr,"Malloc error\n");
+      exit(1);
+    }
+
+  run_segments ();
+
+  if (write(p->fd, segy, 4 * l) != 4 * l) perror ("Write floats");
+  free(segy);
+
+  return;
+}
+
+
+/******************************************************************************/
+/*	run_segments							      */
+/******************************************************************************/
+void run_segments (void)
+{
+  /* hands the buffer to the workers, takes the first segment itself, */
+  /* and waits for the others */
+  pthread_mutex_lock (&worklock);
+  nbusy = nthreads - 1;
+  njobs++;
+  pthread_cond_broadcast (&workcond);
+  pthread_mutex_unlock (&worklock);
+
+  segment_one (0);
+
+  pthread_mutex_lock (&worklock);
+  while (nbusy > 0)
+    pthread_cond_wait (&donecond, &worklock);
+  pthread_mutex_unlock (&worklock);
+
+  return;
+}
+
+/******************************************************************************/
+/*	segment_worker							      */
+/******************************************************************************/
+void *segment_worker (void *wdata)
+{
+  /* worker thread: decimates its segment of every buffer */
+  int w = *(int *) wdata;
+  long long n;
+
+  for (n = 1; ; n++)
+    {
+      pthread_mutex_lock (&worklock);
+      while (njobs < n && !workend)
+	pthread_cond_wait (&workcond, &worklock);
+      if (njobs < n)
+	{
+	  pthread_mutex_unlock (&worklock);
+	  break;
+	}
+      pthread_mutex_unlock (&worklock);
+
+      segment_one (w);
+
+      pthread_mutex_lock (&worklock);
+      if (--nbusy == 0)
+	pthread_cond_signal (&donecond);
+      pthread_mutex_unlock (&worklock);
+    }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/*	segment_one							      */
+/******************************************************************************/
+void segment_one (int w)
+{
+  /* sums or filters output samples w * segout / nthreads up to those of */
+  /* the next thread, then scales and formats them in place */
+  char	*inbuf;
+  float iq[2];
+
+  /* accumulator larger enough to not cause overflow on all downsampled data */
+  int	is  = 0,   qs  = 0;	/* is, qs  : char  accumulators for I & Q */
+  float isf = 0.0, qsf = 0.0;	/* isf, qsf: float accumulators for I & Q */
+
+  int j, k, m;
+  int first = (long long) w * segout / nthreads;
+  int last  = (long long) (w + 1) * segout / nthreads;
+  int nclipped = 0;
+  int d = seg->step;		/* samples summed */
+  float scale = seg->scale;
+
+  float iscale = dcoffi * seg->factor * scale;
+  float qscale = dcoffq * seg->factor * scale;
 
-  for (; bcnt > 0; bcnt--)
+  if (power)
+    {
+      power_one (w);
+      nclip[w] = 0;
+      return;
+    }
+
+  if (!segsum && seg->dec && !seg->dec->cic)
+    fir_range (seg->dec->fir, first, last, seg->raw);
+
+  for (m = first; segsum && m < last; m++)
   {
-    if (mode == 32) {
-	for (j = 0, isf = 0.0, qsf = 0.0; j < downsample; j += 1, k += 8) {
-	  memcpy (&iq[0], &inbuf[k], 8);
+    if (segsrc) {
+	for (j = 0, k = 2 * m * d, isf = 0.0, qsf = 0.0; j < d; j++, k += 2) {
+	  /* sum mixed Is and Qs, or outputs of another product */
+	  isf += segsrc[k];
+	  qsf += segsrc[k+1];
+	}
+    } else if (mode == 32) {
+	for (j = 0, k = 8 * m * d, isf = 0.0, qsf = 0.0; j < d; j += 1, k += 8) {
+	  memcpy (&iq[0], &segin[k], 8);
 
 	  /* sum Is and Qs */
 	  isf  += iq[0];
 	  qsf  += iq[1];
 	}
     } else {
-	for (j = 0, is = 0, qs = 0; j < downsample; j++) {
+	inbuf = segin + 2 * m * d;
+	for (j = 0, is = 0, qs = 0; j < d; j++) {
 	  /* sum Is and Qs */
 	  is  += *inbuf++;
 	  qs  += *inbuf++;
@@ -592,6 +1167,14 @@ void *iq_downsample (void *pdata)
 	isf = (float) is;
 	qsf = (float) qs;
     }
+    seg->raw[2*m]   = isf;
+    seg->raw[2*m+1] = qsf;
+  }
+
+  for (m = first; m < last; m++)
+  {
+    isf = seg->raw[2*m];
+    qsf = seg->raw[2*m+1];
 
     /* finished coherent sum */
     /* SWJ 12/07/04 added IQ swapping capability */
@@ -600,11 +1183,11 @@ void *iq_downsample (void *pdata)
       /* scaling is unnecessary, but it makes */
       /* comparisons with other modes simpler */
       if (swapiq == 0) {
-        y[l++] = scale * isf - iscale;
-        y[l++] = scale * qsf - qscale;
+        segy[2*m]   = scale * isf - iscale;
+        segy[2*m+1] = scale * qsf - qscale;
       } else {
-        y[l++] = scale * qsf - qscale;
-        y[l++] = scale * isf - iscale;
+        segy[2*m]   = scale * qsf - qscale;
+        segy[2*m+1] = scale * isf - iscale;
       }
     }
     else
@@ -621,43 +1204,130 @@ void *iq_downsample (void *pdata)
       if (qs < -128) {qs = -128; nclipped++;}
 	      
       if (swapiq == 0) {
-        x[l++] = (signed char) is;
-        x[l++] = (signed char) qs;
+        segx[2*m]   = (signed char) is;
+        segx[2*m+1] = (signed char) qs;
       } else {
-        x[l++] = (signed char) qs;
-        x[l++] = (signed char) is;
+        segx[2*m]   = (signed char) qs;
+        segx[2*m+1] = (signed char) is;
       }
     }
   }
+  nclip[w] = nclipped;
 
-  /* 03/05/04 SWJ  if (l != nbytes) fprintf(stderr,"oops\n"); */
-  
-  /* print diagnostics */
-  if (clipping && !floats) 
-    fprintf(stderr,"this buffer: output samples %d nclipped %d\n",
-	    nbytes,nclipped); 
+  return;
+}
 
-  /* write it out */
-  /* SWJ - replaced all nbytes with l */
-  if (floats)
-    {
-      if (write(fdoutput, y, 4 * l) != 4 * l) perror ("Write floats");
-      free(y);
-    }
-  else
+
+/******************************************************************************/
+/*	power_one							      */
+/******************************************************************************/
+void power_one (int w)
+{
+  /* integrates the power of output samples w * segout / nthreads up to */
+  /* those of the next thread, of one channel, or of both interleaved */
+  /* or summed */
+  int first = (long long) w * segout / nthreads;
+  int last  = (long long) (w + 1) * segout / nthreads;
+  int d = seg->factor;		/* samples summed */
+  int size = (mode == 32) ? 8 : 2;	/* bytes per sample */
+  int m;
+
+  for (m = first; m < last; m++)
+    switch (power)
+      {
+      case POWER_SINGLE:
+	segy[m] = detect (segpol[0] + (long long) size * m * d, d);
+	break;
+      case POWER_DUAL:
+	segy[2*m]   = detect (segpol[0] + (long long) size * m * d, d);
+	segy[2*m+1] = detect (segpol[1] + (long long) size * m * d, d);
+	break;
+      case POWER_SUM:
+	segy[m] = detect (segpol[0] + (long long) size * m * d, d) +
+	          detect (segpol[1] + (long long) size * m * d, d);
+	break;
+      }
+
+  return;
+}
+
+/******************************************************************************/
+/*	detect								      */
+/******************************************************************************/
+double detect (char *x, int n)
+{
+  /* returns the sum of (I - dcoffi)^2 + (Q - dcoffq)^2 over the n complex
+     samples at x, with the dc offsets applied to the sums of I, Q and
+     I^2 + Q^2.  The sums are accumulated in POWER_LANES independent
+     lanes, I and Q alternating, which the compiler vectorizes; signed
+     bytes are summed in integers and floats in floats, POWER_CHUNK
+     samples at a time so that the lanes neither overflow nor lose
+     precision.
+  */
+  signed char *b = (signed char *) x;
+  float *f = (float *) x;
+  float  fs[POWER_LANES], fp[POWER_LANES];
+  int    is[POWER_LANES], ip[POWER_LANES];
+  double si = 0, sq = 0, sp = 0;
+  int    j, k, l, end;
+
+  for (k = 0; k < 2 * n; k += 2 * POWER_CHUNK)
     {
-      if (write(fdoutput, x, l) != l) perror ("Write bytes");
-      free(x);
+      end = (2 * n - k < 2 * POWER_CHUNK) ? 2 * n : k + 2 * POWER_CHUNK;
+      if (mode == 32)
+	{
+	  for (l = 0; l < POWER_LANES; l++)
+	    fs[l] = fp[l] = 0;
+	  for (j = k; j + POWER_LANES <= end; j += POWER_LANES)
+	    for (l = 0; l < POWER_LANES; l++)
+	      {
+		fs[l] += f[j+l];
+		fp[l] += f[j+l] * f[j+l];
+	      }
+	  for (l = 0; j + l < end; l++)
+	    {
+	      fs[l] += f[j+l];
+	      fp[l] += f[j+l] * f[j+l];
+	    }
+	  for (l = 0; l < POWER_LANES; l += 2)
+	    {
+	      si += fs[l];
+	      sq += fs[l+1];
+	      sp += fp[l] + fp[l+1];
+	    }
+	}
+      else
+	{
+	  for (l = 0; l < POWER_LANES; l++)
+	    is[l] = ip[l] = 0;
+	  for (j = k; j + POWER_LANES <= end; j += POWER_LANES)
+	    for (l = 0; l < POWER_LANES; l++)
+	      {
+		is[l] += b[j+l];
+		ip[l] += b[j+l] * b[j+l];
+	      }
+	  for (l = 0; j + l < end; l++)
+	    {
+	      is[l] += b[j+l];
+	      ip[l] += b[j+l] * b[j+l];
+	    }
+	  for (l = 0; l < POWER_LANES; l += 2)
+	    {
+	      si += is[l];
+	      sq += is[l+1];
+	      sp += ip[l] + ip[l+1];
+	    }
+	}
     }
 
-  return NULL;
-}    
+  return sp - 2 * (dcoffi * si + dcoffq * sq) + n * (dcoffi * dcoffi + dcoffq * dcoffq);
+}
 
 
 /******************************************************************************/
 /*	processargs							      */
 /******************************************************************************/
-void	processargs(argc,argv,infile,outfile,mode,downsample,chan,dcoffi,dcoffq,fudge,samplestoskip)
+void	processargs(argc,argv,infile,outfile,mode,downsample,chan,dcoffi,dcoffq,fudge,samplestoskip,modelfile,fsamp,ntaps,fpass,fstop,nthreads,center,bandwidth)
 int	argc;
 char	**argv;			 /* command line arguements */
 char	**infile;		 /* input file name */
@@ -669,6 +1339,14 @@ float   *dcoffi;
 float   *dcoffq;
 float   *fudge;
 long 	*samplestoskip;
+char   **modelfile;
+double  *fsamp;
+int     *ntaps;
+float   *fpass;
+float   *fstop;
+int     *nthreads;
+double  *center;
+double  *bandwidth;
 {
   /* function to process a programs input command line.
      This is a template which has been customised for the pfs_downsample program:
@@ -681,10 +1359,11 @@ long 	*samplestoskip;
   extern int optind;	/* after call, ind into argv for next*/
   extern int opterr;    /* if 0, getopt won't output err mesg*/
 
-  char *myoptions = "m:o:d:c:s:I:Q:b:f:axqi"; 	 /* options to search for :=> argument*/
-  char *USAGE1="pfs_downsample -m mode -d downsampling factor [-s number of complex samples to skip] [-f scale fudge factor] [-b output byte quantities (default floats)] [-a downsample all data files] [-I dcoffi] [-Q dcoffq] [-c channel (1 or 2)] [-x (swap I/Q)] [-q (quiet mode)] [-o outfile] [infile] ";
+  char *myoptions = "m:o:d:c:s:I:Q:b:f:axqiX:F:L:p:T:P:C:B:W:"; 	 /* options to search for :=> argument*/
+  char *USAGE1="pfs_downsample -m mode -d downsampling factor [-s number of complex samples to skip] [-f scale fudge factor] [-b output byte quantities (default floats)] [-a downsample all data files] [-I dcoffi] [-Q dcoffq] [-c channel (1 or 2)] [-x (swap I/Q)] [-q (quiet mode)] [-X frequency model file] [-C center frequency (Hz)] [-B output bandwidth (Hz)] [-F sampling frequency (MHz)] [-L filter taps] [-p passband,stopband (output rate)] [-T threads] [-P channel,factor,outfile ...] [-W single|dual|sum (integrate power)] [-o outfile] [infile] ";
   char *USAGE2="Valid modes are\n\t 0: 2c1b (N/A)\n\t 1: 2c2b\n\t 2: 2c4b\n\t 3: 2c8b\n\t 4: 4c1b (N/A)\n\t 5: 4c2b\n\t 6: 4c4b\n\t 7: 4c8b (N/A)\n\t 8: signed bytes\n\t32: 32bit floats\n";
   int  c;			 /* option letter returned by getopt  */
+  int  k;			 /* product index */
   int  arg_count = 1;		 /* optioned argument count */
 
   /* default parameters */
@@ -699,6 +1378,14 @@ long 	*samplestoskip;
   *dcoffq = 0;
   *fudge = 1;
   *samplestoskip = 0;
+  *modelfile = "-";
+  *fsamp = 0;
+  *ntaps = 0;		/* default is a sum of samples */
+  *fpass = 0.4;
+  *fstop = 0.6;
+  *nthreads = 0;	/* default is one thread per processor */
+  *center = 0;
+  *bandwidth = 0;
   floats = 1;
   allfiles = 0;
   swapiq = 0;
@@ -768,6 +1455,60 @@ long 	*samplestoskip;
       sscanf(optarg,"%ld",samplestoskip);
       arg_count += 2;           /* two command line arguments */
       break;
+
+    case 'X':
+      *modelfile = optarg;
+      arg_count += 2;
+      break;
+
+    case 'F':
+      sscanf(optarg,"%lf",fsamp);
+      arg_count += 2;
+      break;
+
+    case 'L':
+      sscanf(optarg,"%d",ntaps);
+      arg_count += 2;
+      break;
+
+    case 'p':
+      if (sscanf(optarg,"%f,%f",fpass,fstop) != 2)
+	goto errout;
+      arg_count += 2;
+      break;
+
+    case 'T':
+      sscanf(optarg,"%d",nthreads);
+      arg_count += 2;
+      break;
+
+    case 'C':
+      sscanf(optarg,"%lf",center);
+      arg_count += 2;
+      break;
+
+    case 'B':
+      sscanf(optarg,"%lf",bandwidth);
+      arg_count += 2;
+      break;
+
+    case 'W':
+      if      (strcmp(optarg,"single") == 0) power = POWER_SINGLE;
+      else if (strcmp(optarg,"dual")   == 0) power = POWER_DUAL;
+      else if (strcmp(optarg,"sum")    == 0) power = POWER_SUM;
+      else goto errout;
+      arg_count += 2;
+      break;
+
+    case 'P':
+      if (nproducts == MAXPRODUCTS) goto errout;
+      products[nproducts].outfile = (char *) malloc(strlen(optarg) + 1);
+      if (sscanf(optarg,"%d,%d,%s",&products[nproducts].chan,&products[nproducts].factor,
+		 products[nproducts].outfile) != 3)
+	goto errout;
+      nproducts++;
+      arg_count += 2;
+      break;
   
     case '?':                    /*if not in myoptions, getopt rets ? */
       goto errout;
@@ -789,8 +1530,35 @@ long 	*samplestoskip;
         strncpy (header, *infile, strlen(*infile) - strlen(header));
   } 
 
-  /* must specify a valid mode and downsampling factor */
-  if (*mode == 0 || *downsample < 1) goto errout;
+  /* must specify a valid mode and downsampling factor, */
+  /* or products instead of -d and -o */
+  if (*mode == 0) goto errout;
+  if (nproducts == 0 && *downsample < 1 && *bandwidth <= 0) goto errout;
+  if (*bandwidth > 0 && (*downsample != 0 || nproducts > 0)) goto errout;
+  if (nproducts > 0 && (*downsample != 0 || (*outfile)[0] != '-')) goto errout;
+  if (*chan < 1 || *chan > 2) goto errout;
+  for (k = 0; k < nproducts; k++)
+    if (products[k].factor < 1 || products[k].chan < 1 || products[k].chan > 2) goto errout;
+
+  /* only modes 5 to 7 have a second channel for products */
+  for (k = 0; k < nproducts; k++)
+    if (products[k].chan != 1 && (*mode < 5 || *mode > 7)) goto errout;
+
+  /* the filter edges must be in order */
+  if (*ntaps < 0 || *fpass <= 0 || *fstop <= *fpass) goto errout;
+
+  if (*nthreads < 0) goto errout;
+
+  /* the frequency model requires the sampling frequency */
+  if (*modelfile[0] != '-' && *fsamp <= 0) goto errout;
+
+  /* and so do tuning and the bandwidth */
+  if (*bandwidth < 0) goto errout;
+
+  /* power is integrated from the samples as decoded, into floats */
+  if (power && (!floats || *ntaps || nproducts || *bandwidth != 0 || *center != 0 ||
+		*modelfile[0] != '-')) goto errout;
+  if ((*center != 0 || *bandwidth != 0) && *fsamp <= 0) goto errout;
   
   return;
 
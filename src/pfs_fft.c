@@ -18,9 +18,24 @@
 *              [-c channel] 
 *              [-i swap IQ before transform (invert freq axis)]
 *              [-H apply Hanning window before transform]
+*              [-P number of polyphase filter bank taps per branch]
+*              [-F prototype filter for polyphase filter bank]
+*              [-z write complex channel time series]
+*              [-w follow a file being written, stop after w idle seconds]
+*              [-k checkpoint file]
+*              [-R (resume from checkpoint file)]
+*              [-M ckptfile1,ckptfile2,... (sum checkpointed integrations)]
+*              [-q bits per channel for compact time series output (8 or 16)]
+*              [-g f1,f2,... (Hz) power at listed frequencies only]
+*              [-K M,nsigma spectral kurtosis excision over blocks of M transforms]
+*              [-D snrmin,K write the K strongest channels above snrmin sigmas]
+*              [-a (process all files of a multifile series)]
+*              [-j number of worker processes]
+*              [-X file of signal frequency versus time to compensate]
+*              [-e (binary output in a self-describing file of spectra)]
 *              [-C file of Chebyshev polynomial coefficients defining window to apply after transform] 
 *              [-S number of seconds to skip before applying first FFT]
-*              [-o outfile] [infile]
+*              [-o outfile] [infile (- for stdin)]
 *
 *  input:
 *       the input parameters are typed in as command line arguments
@@ -35,6 +50,74 @@
 *			one after the other until EOF
 *       the -x option specifies an optional range of output frequencies
 *       the -c argument specifies which channel (1 or 2) to process
+*       the -P argument replaces the Hanning window with a critically sampled
+*                       polyphase filter bank of P taps per branch
+*       the -F argument specifies the prototype filter of the filter bank:
+*                       hamming (default), hanning, blackman, or the name
+*                       of a file of P*fftlen coefficients
+*       the -z option writes the complex channel outputs of every transform
+*                       (fftlen I,Q pairs of floats) instead of powers
+*
+*       the input file may be a pipe; it is stdin if omitted or given as -
+*       the -w argument processes a file that is still being recorded:
+*                       at EOF, wait for more data and continue with the
+*                       next file of a prefix.000, prefix.001, ... series,
+*                       stopping when the recording ends or after w
+*                       seconds without new data
+*       the -k argument saves the state of a -n integration (input offset,
+*                       number of transforms, double precision sum, and
+*                       parameters) to a checkpoint file every minute and
+*                       when the integration completes
+*       the -R option resumes an interrupted integration from the -k file
+*       the -M argument sums the integrations saved in checkpoint files
+*                       from runs over disjoint data and outputs the result
+*                       without reading any data
+*       the -q argument writes the -t time series as a SIGPROC filterbank
+*                       file of 8 or 16 bit unsigned channels; the offset
+*                       and scale (value = offset + scale * channel) of
+*                       each spectrum are written as pairs of floats to
+*                       outfile.scl
+*       the -g argument replaces the transform by a bank of Goertzel
+*                       filters evaluating the power at up to 64 listed
+*                       frequencies, with the same resolution and scale as
+*                       the transform; (sums of) powers are written one
+*                       line per time step until EOF, preceded by the time
+*                       in seconds unless -b is used
+*       the -K argument computes the spectral kurtosis of every channel
+*                       over blocks of M transforms; blocks of a channel
+*                       more impulsive than Gaussian noise by more than
+*                       nsigma (default 3) are left out of the sum, while
+*                       steady carriers, less variable than noise, are
+*                       kept; the whole block is left out if more than
+*                       half the channels are flagged,
+*                       and the sum is rescaled to n transforms (channels
+*                       without any clean block are set to zero)
+*       the -D argument scales each (sum of) transforms to sigmas as with
+*                       -s, which is required, and writes only the K
+*                       strongest (default 100) channels exceeding snrmin
+*                       sigmas over the whole time series, limited to the
+*                       -x range if given, with summary statistics; adjacent
+*                       channels above snrmin count as one candidate, at
+*                       the strongest of them
+*       the -a option reads infile, normally prefix.000, and the files
+*                       following it in a prefix.001, prefix.002, ...
+*                       series as a single stream
+*       the -j argument splits the data into contiguous ranges of whole
+*                       -t integrations or -n transforms, processed by j
+*                       worker processes; -t outputs are written in order
+*                       and -n sums are added once all workers are done
+*       the -X argument names a polynomial or tabulated model of the signal
+*                       frequency (Hz) versus time from the start of the
+*                       file (s), such as a Doppler prediction; the data
+*                       are mixed to keep the signal at zero frequency
+*                       before downsampling and transforms (see doppler.c)
+*       the -e option writes the (time series of) spectra as binary floats
+*                       preceded by a header recording the processing
+*                       parameters and the command line, and followed by
+*                       an index of the spectra, so that other programs
+*                       can map the file and read any spectrum directly
+*                       (see spectra.c); pfs_dehop and pfs_dedoppler
+*                       recognize such files
 *
 *  output:
 *	the -o option identifies the output file, stdout is default
@@ -139,7 +222,13 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
 #include "unpack.h"
+#include "streamfile.h"
+#include "doppler.h"
+#include "spectra.h"
+#include "candidate.h"
 #include <fftw3.h>
 
 /* revision control variable */
@@ -147,26 +236,94 @@ static char const rcsid[] =
 "$Id: pfs_fft.c,v 4.2 2020/05/21 17:44:12 jlm Exp $";
 
 FILE   *fpoutput;		/* pointer to output file */
-int	fdinput;		/* file descriptor for input file */
+struct STREAMFILE *input;	/* buffered input file */
 
 char   *outfile;		/* output file name */
 char   *infile;		        /* input file name */
 char   *chebfile;	        /* file of Chebyshev coefficients */
+char   *pfbfilter;	        /* prototype filter for polyphase filter bank */
+char   *modelfile;	        /* file of signal frequency versus time */
 
 char	command_line[512];	/* command line assembled by processargs */
 
+/* state of a -n integration saved with -k */
+struct CHECKPOINT {
+  char   magic[8];		/* "PFSCKP2", sums follow as doubles */
+  int    size;			/* size of this structure */
+  int    mode;
+  int    chan;
+  int    downsample;
+  int    fftlen;
+  int    ntaps;
+  int    invert;
+  int    hanning;
+  double fsamp;
+  double freqres;
+  long long ntransforms;	/* number of transforms summed */
+  long long offset;		/* input byte offset following the last transform */
+  char   pfbfilter[256];
+};
+
+#define CKPT_INTERVAL 60	/* seconds between checkpoints */
+
+#define ACCUM_BLOCK 256		/* transforms summed in float before folding into double */
+
+/* compact time series output, written in batches */
+FILE   *fpscale;		/* pointer to file of offsets and scales */
+unsigned char *qbuf;		/* batch of quantized spectra */
+float  *qscale;			/* batch of offsets and scales */
+int	qbatch;			/* number of spectra per batch */
+int	qfill = 0;		/* number of spectra in batch */
+
+#define QBATCH_BYTES (4 * 1024 * 1024)
+
+#define MAXTONES 64		/* maximum number of -g frequencies */
+
+/* candidate detection, written at the end of the time series */
+struct CANDIDATE *candheap;	/* strongest candidates, weakest at the root */
+int	maxcand;		/* number of candidates to keep, 0 for no detection */
+int	ncand = 0;		/* number of candidates kept */
+float	snrmin;			/* detection threshold, sigmas */
+long long nabove = 0;		/* number of channels above threshold */
+long long ngroups = 0;		/* number of groups of adjacent channels above threshold */
+long long nsearched = 0;	/* number of channels searched */
+int	nspectra = 0;		/* number of integrations searched */
+float	snrmax = 0;		/* strongest channel */
+
+/* parallel processing by worker processes */
+#define MAXWORKERS 256
+
+char	workerbase[512];	/* prefix of the workers' output files */
+#define WORKERFILE_LEN (sizeof(workerbase) + 16) /* room for the worker number */
+
 void processargs();
 void open_file();
 void copy_cmd_line();
 void vector_power(float *data, int len);
+void downsample_int16(short *in, float *out, int len, int downsample);
+void downsample_float(float *in, float *out, int len, int downsample);
 void vector_window(float *data, int len);
 void chebyshev_window(float *data, int len, double *chebcoeff, int degree);
 void swap_freq(float *data, int len);
 void swap_iandq(float *data, int len);
 void zerofill(float *data, int len);
+void fold_sum(double *sum, float *block, int len);
 int  no_comma_in_string();	
 double chebeval(double x, double c[], int degree);
 int  read_cheb_coeffs(char *chebfile, double *chebcoeff);
+void pfb_prototype(float *coeff, int len, int ntaps, char *pfbfilter);
+void pfb_fir(float *hist, float *coeff, float *data, int len, int ntaps, int newest);
+void write_checkpoint(char *ckptfile, struct CHECKPOINT *ckpt, double *total);
+long long read_checkpoint(char *ckptfile, struct CHECKPOINT *ckpt, double *total);
+void write_filterbank_header(FILE *fp, char *infile, int len, double freqres, double tsamp, int nbits);
+void quantize_spectrum(float *data, int len, int nbits, unsigned char *out, float *offscale);
+void flush_waterfall(int len, int nbits);
+void goertzel_bank(float *data, int len, double *tonefreq, int ntones, double fs, float *power);
+int  kurtosis_excision(float *s1, float *s2, float *total, float *count, int len, int m, float nsigma);
+void write_candidates(void);
+int  spawn_workers(int nworkers);
+void worker_file(char *name, int k);
+void concat_workers(int nworkers);
 
 int main(int argc, char *argv[])
 {
@@ -181,9 +338,54 @@ int main(int argc, char *argv[])
 
   float *fftinbuf, *fftoutbuf;
   float *total;
+  double *master;	/* sum of transforms, folded from total every ACCUM_BLOCK */
 
   double *chebcoeff;    /* array for polynomial coefficients */
 
+  float *pfbcoeff = NULL;	/* polyphase filter bank coefficients, duplicated for I and Q */
+  float *pfbhist = NULL;	/* last ntaps blocks of samples entering the filter bank */
+  int ntaps;		/* number of filter bank taps per branch, 0 for none */
+  int pfbslot = -1;	/* history slot holding the newest block */
+  int pfbfill = 0;	/* number of history slots filled so far */
+  int complexout;	/* write complex channel outputs instead of powers */
+  int follow;		/* seconds to wait for a growing file, 0 for none */
+  char *ckptfile;	/* checkpoint file, - for none */
+  char *mergefiles;	/* comma-separated checkpoint files to sum, - for none */
+  char *mergefile;	/* one of the checkpoint files to sum */
+  int resume;		/* resume from checkpoint file */
+  struct CHECKPOINT ckpt; /* integration state */
+  time_t nextckpt;	/* time of next checkpoint */
+  long long first = 0;	/* number of transforms already in total */
+  int qbits;		/* bits per channel of compact time series, 0 for floats */
+  char scalefile[512];	/* name of file of offsets and scales */
+  double tonefreq[MAXTONES]; /* frequencies of tone bank, Hz */
+  int ntones;		/* number of tone bank frequencies, 0 for transform */
+  float *tonepow;	/* sum of powers at tone bank frequencies */
+  int skblock;		/* transforms per spectral kurtosis block, 0 for none */
+  float sknsigma;	/* spectral kurtosis flagging threshold, sigmas */
+  float *sks1, *sks2;	/* block sums of powers and squared powers */
+  float *skcount;	/* number of transforms summed in each channel */
+  struct CANDIDATE cand; /* strongest channel of a group above detection threshold */
+  int ingroup;		/* cand holds a group still open */
+  int above;		/* channel searched and above detection threshold */
+  int allfiles;		/* read all files of a multifile series */
+  int container;	/* write spectra with a header and an index */
+  struct SPECHEADER spechdr; /* parameters recorded with the spectra */
+  struct SPECFILE *spec = NULL; /* output file of spectra, if any */
+  int nworkers;		/* number of worker processes */
+  int worker = -1;	/* number of this worker, -1 if not a worker */
+  char partfile[WORKERFILE_LEN]; /* output file of this worker */
+  char *mergelist;	/* output files of all workers */
+  long long unit;	/* transforms per range unit */
+  long long nunits;	/* number of range units to process */
+  long long ustart,uend; /* range units of this worker */
+  long long limit = 0;	/* input offset at which this worker stops */
+  int pre;		/* transforms filling the filter bank history */
+  struct DOPPLER *dop = NULL; /* frequency model to compensate, if any */
+  float *mixbuf;	/* samples mixed at the full sampling rate */
+  long long skflagged = 0; /* number of channel blocks left out */
+  long long skblocks = 0;  /* number of channel blocks examined */
+
   float freq;		/* frequency */
   float freqmin;	/* min frequency to output */
   float freqmax;	/* max frequency to output */
@@ -202,7 +404,6 @@ int main(int argc, char *argv[])
   int fftlen;		/* transform length, complex samples */
   int chan;		/* channel to process (1 or 2) for dual pol data */
   int counter=0;	/* keeps track of number of transforms written */
-  int open_flags;	/* flags required for open() call */
   int invert;		/* swap i and q before fft routine */
   int hanning;		/* apply Hanning window before fft routine */
   int swap = 1;		/* swap frequencies at output of fft routine */
@@ -213,10 +414,9 @@ int main(int argc, char *argv[])
   
   fftwf_plan p;
   int i,j,k,l,n,n1;
-  short x;
 
   /* get the command line arguments */
-  processargs(argc,argv,&infile,&outfile,&mode,&fsamp,&freqres,&downsample,&sum,&binary,&timeseries,&chan,&freqmin,&freqmax,&rmsmin,&rmsmax,&dB,&invert,&hanning,&chebfile,&nskipseconds);
+  processargs(argc,argv,&infile,&outfile,&mode,&fsamp,&freqres,&downsample,&sum,&binary,&timeseries,&chan,&freqmin,&freqmax,&rmsmin,&rmsmax,&dB,&invert,&hanning,&chebfile,&nskipseconds,&ntaps,&pfbfilter,&complexout,&follow,&ckptfile,&resume,&mergefiles,&qbits,tonefreq,&ntones,&skblock,&sknsigma,&snrmin,&maxcand,&allfiles,&nworkers,&modelfile,&container);
 
   /* save the command line */
   copy_cmd_line(argc,argv,command_line);
@@ -224,14 +424,6 @@ int main(int argc, char *argv[])
   /* open output file, stdout default */
   open_file(outfile,&fpoutput);
 
-  /* open file input */
-  open_flags = O_RDONLY;
-  if((fdinput = open(infile, open_flags)) < 0 )
-    {
-      perror("open input file");
-      exit(1);
-    }
-
   /* read Cheb coefficients, if requested */
   if (chebfile[0] != '-') 
     {
@@ -279,15 +471,123 @@ int main(int argc, char *argv[])
     }
   if (chebfile[0] != '-')
     fprintf(stderr, "Degree of Chebyshev polynomial : %d\n",degree);    
+  if (ntaps)
+    fprintf(stderr,"Polyphase filter bank          : %d taps per branch, %s prototype\n",ntaps,pfbfilter);
+  if (ntones)
+    fprintf(stderr,"Goertzel filter bank           : %d frequencies\n",ntones);
+  if (skblock)
+    fprintf(stderr,"Spectral kurtosis excision     : blocks of %d transforms, %g sigmas\n",skblock,sknsigma);
+  if (maxcand)
+    fprintf(stderr,"Candidate detection            : %d strongest above %g sigmas\n",maxcand,snrmin);
   /* for (i = 0; i <= degree; i++) fprintf(stderr, "%d %lf\n", i, chebcoeff[i]); */
   fprintf(stderr,"\n");
-    
-  /* skip unwanted bytes */
-  /* fsamp samples per second during nskipseconds, and 4/smpwd bytes per complex sample */
-  if (nskipbytes != lseek(fdinput, nskipbytes, SEEK_SET))
+
+  /* file of spectra: header now, index once the output is complete; */
+  /* a single spectrum is limited to the -x range                    */
+  if (container)
     {
-      fprintf(stderr,"Read error while skipping %ld bytes.  Check file size.\n",nskipbytes);
-      exit(1);
+      memset(&spechdr, 0, sizeof(spechdr));
+      spechdr.mode       = mode;
+      spechdr.fftlen     = fftlen;
+      spechdr.downsample = downsample;
+      spechdr.fsamp      = fsamp;
+      spechdr.freqres    = freqres;
+      spechdr.sum        = sum;
+      spechdr.start      = nskipbytes * smpwd / 4.0 / (fsamp * 1e6);
+      spechdr.tint       = sum / freqres;
+      strncpy(spechdr.command, command_line + 1, sizeof(spechdr.command) - 1);
+      for (i = 0; i < fftlen; i++)
+	{
+	  freq = (i-fftlen/2)*freqres;
+	  if (timeseries || (freqmin == 0.0 && freqmax == 0.0) || (freq >= freqmin && freq <= freqmax))
+	    if (spechdr.nchan++ == 0) spechdr.freqmin = freq;
+	}
+      if (spechdr.nchan == 0)
+	{
+	  fprintf(stderr,"No channels between %g and %g Hz\n",freqmin,freqmax);
+	  exit(1);
+	}
+      if ((spec = spec_create(fpoutput, &spechdr)) == NULL)
+	exit(1);
+    }
+
+  /* split the data into contiguous ranges of whole integrations (-t) or */
+  /* transforms (-n), one per worker process; each range is read from    */
+  /* ntaps-1 transforms ahead, to fill the filter bank history          */
+  if (nworkers > 1)
+    {
+      unit = timeseries ? sum : 1;
+      pre  = ntaps ? ntaps - 1 : 0;
+      nunits = (stream_size(infile, allfiles) - nskipbytes) / bufsize - pre;
+      if (nunits < sum)
+	{
+	  fprintf(stderr,"Not enough data for %lld transforms\n",sum);
+	  exit(1);
+	}
+      nunits = timeseries ? nunits / sum : sum;
+      if (nworkers > nunits) nworkers = nunits;
+      fprintf(stderr,"Worker processes               : %d\n\n",nworkers);
+
+      worker = spawn_workers(nworkers);
+      if (worker >= 0)
+	{
+	  ustart = nunits * worker / nworkers;
+	  uend   = nunits * (worker + 1) / nworkers;
+	  limit  = nskipbytes + (uend * unit + pre) * bufsize;
+	  nskipbytes += ustart * unit * bufsize;
+	  worker_file(partfile, worker);
+	  spec = NULL;
+	  if (timeseries)
+	    open_file(partfile,&fpoutput);
+	  else
+	    {
+	      sum = uend - ustart;
+	      ckptfile = partfile;
+	    }
+	}
+      else if (timeseries)
+	{
+	  concat_workers(nworkers);
+	  if (spec)
+	    {
+	      spec_extend(spec, nunits);
+	      spec_close(spec);
+	    }
+	  fprintf(stderr,"Wrote %lld transforms\n",nunits);
+	  fclose(fpoutput);
+	  exit(0);
+	}
+      else
+	{
+	  /* sum the integrations of all workers */
+	  mergelist = (char *) malloc(nworkers * sizeof(partfile));
+	  if (!mergelist)
+	    {
+	      fprintf(stderr,"Malloc error\n"); 
+	      exit(1);
+	    }
+	  mergelist[0] = '\0';
+	  for (k = 0; k < nworkers; k++)
+	    {
+	      worker_file(partfile, k);
+	      if (k) strcat(mergelist, ",");
+	      strcat(mergelist, partfile);
+	    }
+	  mergefiles = mergelist;
+	}
+    }
+
+  /* open file input, stdin default, unless summing checkpoints */
+  if (mergefiles[0] == '-')
+    {
+      if((input = stream_open(infile, 0)) == NULL)
+	{
+	  perror("open input file");
+	  exit(1);
+	}
+      if (follow) stream_follow(input, follow);
+      if (allfiles) stream_series(input);
+      if (limit) stream_limit(input, limit);
     }
 
   /* verify that scaling request is sensible */
@@ -306,29 +606,158 @@ int main(int argc, char *argv[])
   fftinbuf  = (float *) malloc(2 * fftlen * sizeof(float));
   fftoutbuf = (float *) malloc(2 * fftlen * sizeof(float));
   total = (float *) malloc(fftlen * sizeof(float));
+  master = (double *) malloc(fftlen * sizeof(double));
   rcp   = (char *)  malloc(2 * nsamples * sizeof(char));
-  if (!buffer || !fftinbuf || !fftoutbuf || !total || !rcp)
+  tonepow = (float *) malloc(MAXTONES * sizeof(float));
+  mixbuf  = (float *) malloc(2 * nsamples * sizeof(float));
+  sks1    = (float *) malloc(fftlen * sizeof(float));
+  sks2    = (float *) malloc(fftlen * sizeof(float));
+  skcount = (float *) malloc(fftlen * sizeof(float));
+  candheap = (struct CANDIDATE *) malloc(maxcand * sizeof(struct CANDIDATE));
+  if (!buffer || !fftinbuf || !fftoutbuf || !total || !master || !rcp || !mixbuf || !tonepow || !sks1 || !sks2 || !skcount || !candheap)
     {
       fprintf(stderr,"Malloc error\n"); 
       exit(1);
     }
 
+  /* filter bank coefficients and history */
+  if (ntaps)
+    {
+      pfbcoeff = (float *) malloc(2 * ntaps * fftlen * sizeof(float));
+      pfbhist  = (float *) calloc(2 * ntaps * fftlen, sizeof(float));
+      if (!pfbcoeff || !pfbhist)
+	{
+	  fprintf(stderr,"Malloc error\n"); 
+	  exit(1);
+	}
+      pfb_prototype(pfbcoeff, fftlen, ntaps, pfbfilter);
+    }
+
+  /* compact time series: header, offsets and scales, and batch storage */
+  if (qbits)
+    {
+      qbatch = QBATCH_BYTES / (fftlen * qbits / 8);
+      if (qbatch < 1) qbatch = 1;
+      qbuf   = (unsigned char *) malloc((long) qbatch * fftlen * qbits / 8);
+      qscale = (float *) malloc(2 * qbatch * sizeof(float));
+      if (!qbuf || !qscale)
+	{
+	  fprintf(stderr,"Malloc error\n"); 
+	  exit(1);
+	}
+      snprintf(scalefile, sizeof(scalefile), "%s.scl", outfile);
+      if ((fpscale = fopen(scalefile,"w")) == NULL)
+	{
+	  perror("open scale file");
+	  exit(1);
+	}
+      write_filterbank_header(fpoutput, infile, fftlen, freqres, sum / freqres, qbits);
+    }
+
+  /* parameters that must match for checkpoints to be combined */
+  memset(&ckpt, 0, sizeof(ckpt));
+  strcpy(ckpt.magic, "PFSCKP2");
+  ckpt.size       = sizeof(ckpt);
+  ckpt.mode       = mode;
+  ckpt.chan       = chan;
+  ckpt.downsample = downsample;
+  ckpt.fftlen     = fftlen;
+  ckpt.ntaps      = ntaps;
+  ckpt.invert     = invert;
+  ckpt.hanning    = hanning;
+  ckpt.fsamp      = fsamp;
+  ckpt.freqres    = freqres;
+  strncpy(ckpt.pfbfilter, ntaps ? pfbfilter : "", sizeof(ckpt.pfbfilter) - 1);
+  nextckpt = time(NULL) + CKPT_INTERVAL;
+
+  /* sum integrations from checkpoint files; no data are read */
+  if (mergefiles[0] != '-')
+    {
+      memset(master, 0, fftlen * sizeof(double));
+      for (mergefile = strtok(mergefiles, ","); mergefile; mergefile = strtok(NULL, ","))
+	first += read_checkpoint(mergefile, &ckpt, master);
+      fprintf(stderr,"Summed checkpointed transforms : %lld\n\n",first);
+      sum = first;
+      if (spec) spec_integration(spec, sum, sum / freqres);
+
+      /* integrations of workers are no longer needed */
+      for (k = 0; nworkers > 1 && k < nworkers; k++)
+	{
+	  worker_file(partfile, k);
+	  unlink(partfile);
+	}
+    }
+
+  /* resume an integration where its checkpoint left off, */
+  /* backing up to refill the filter bank history */
+  if (resume)
+    {
+      memset(master, 0, fftlen * sizeof(double));
+      first = read_checkpoint(ckptfile, &ckpt, master);
+      nskipbytes = ckpt.offset - (ntaps ? (ntaps - 1) * bufsize : 0);
+      fprintf(stderr,"Resuming after transform       : %lld\n",first);
+      fprintf(stderr,"Resuming from BOF              : %ld bytes\n\n",nskipbytes);
+    }
+
+  /* skip unwanted bytes */
+  /* fsamp samples per second during nskipseconds, and 4/smpwd bytes per complex sample */
+  if (input && nskipbytes != stream_skip(input, nskipbytes))
+    {
+      fprintf(stderr,"Read error while skipping %ld bytes.  Check file size.\n",nskipbytes);
+      exit(1);
+    }
+
+  /* frequency model starts at the first sample read */
+  if (modelfile[0] != '-')
+    {
+      dop = doppler_open(modelfile, fsamp, nskipbytes * smpwd / 4.0 / (fsamp * 1e6));
+      if (dop == NULL)
+	exit(1);
+    }
+
   /* compute fft plan */
   p = fftwf_plan_dft_1d(fftlen, (fftwf_complex *)fftinbuf, (fftwf_complex *)fftoutbuf, FFTW_FORWARD, FFTW_ESTIMATE);
 
   /* label used if time series is requested */
  loop:
 
-  /* sum transforms */
+  /* sum transforms, unless master already holds some; blocks of */
+  /* transforms are summed in total and folded into master */
+  if (first == 0) memset(master, 0, fftlen * sizeof(double));
   zerofill(total, fftlen);
-  for (i = 0; i < sum; i++)
+  zerofill(tonepow, ntones);
+  if (skblock)
+    {
+      zerofill(sks1, fftlen);
+      zerofill(sks2, fftlen);
+      zerofill(skcount, fftlen);
+    }
+  for (i = first; i < sum; i++)
     {
       /* initialize fft array to zero */
       zerofill(fftinbuf, 2 * fftlen);
       
       /* read one data buffer       */
-      if (bufsize != read(fdinput, buffer, bufsize))
+      if (bufsize != stream_read(input, buffer, bufsize))
 	{
+	  /* in follow mode, the end of the recording is the normal exit */
+	  if (qbits) flush_waterfall(fftlen, qbits);
+	  if (maxcand) write_candidates();
+	  if (spec) spec_close(spec);
+
+	  /* a worker stops at the end of its range */
+	  if (worker >= 0 && input->offset == input->limit)
+	    {
+	      fclose(fpoutput);
+	      exit(0);
+	    }
+	  if (follow && input->eof)
+	    {
+	      fprintf(stderr,"End of recording.\n");
+	      if (timeseries) fprintf(stderr,"Wrote %d transforms\n",counter);
+	      fclose(fpoutput);
+	      exit(0);
+	    }
 	  fprintf(stderr,"Read error or EOF.\n");
 	  if (timeseries) fprintf(stderr,"Wrote %d transforms\n",counter);
 	  exit(1);
@@ -358,22 +787,34 @@ int main(int argc, char *argv[])
 	  memcpy (rcp, buffer, bufsize);
 	  break;
 	case 16: 
-	  for (i = 0, j = 0; i < bufsize; i+=sizeof(short), j++)
-	    {
-	      memcpy(&x,&buffer[i],sizeof(short));
-	      fftinbuf[j] = (float) x;
-	    }
-	  break;
      	case 32: 
-	  memcpy(fftinbuf,buffer,bufsize);
+	  /* converted while downsampling */
 	  break;
 	default: 
 	  fprintf(stderr,"Mode not implemented yet\n"); 
 	  exit(-1);
 	}
 
+      /* compensate the frequency model at the full sampling rate */
+      if (dop)
+	{
+	  if (mode == 16)
+	    downsample_int16((short *) buffer, mixbuf, nsamples, 1);
+	  else if (mode == 32)
+	    memcpy(mixbuf, buffer, bufsize);
+	  else
+	    for (k = 0; k < 2*nsamples; k++)
+	      mixbuf[k] = (float) rcp[k];
+	  doppler_mix(dop, mixbuf, nsamples);
+	  downsample_float(mixbuf, fftinbuf, fftlen, downsample);
+	}
+
       /* downsample */
-      if (mode != 16 && mode != 32)
+      else if (mode == 16)
+	downsample_int16((short *) buffer, fftinbuf, fftlen, downsample);
+      else if (mode == 32)
+	downsample_float((float *) buffer, fftinbuf, fftlen, downsample);
+      else
 	for (k = 0, l = 0; k < 2*fftlen; k += 2, l += 2*downsample)
 	  {
 	    for (j = 0; j < 2*downsample; j+=2)
@@ -383,18 +824,128 @@ int main(int argc, char *argv[])
 	      }
 	  }
 
+      /* polyphase filter bank: keep the newest block in the history and  */
+      /* do not transform until ntaps blocks are available */
+      if (ntaps)
+	{
+	  pfbslot = (pfbslot + 1) % ntaps;
+	  memcpy(&pfbhist[2 * fftlen * pfbslot], fftinbuf, 2 * fftlen * sizeof(float));
+	  if (++pfbfill < ntaps)
+	    {
+	      i--;
+	      continue;
+	    }
+	  pfb_fir(pfbhist, pfbcoeff, fftinbuf, fftlen, ntaps, pfbslot);
+	}
+
       /* transform, swap, and compute power */
       if (invert) swap_iandq(fftinbuf,fftlen); 
       if (hanning) vector_window(fftinbuf,fftlen);
+
+      /* tone bank replaces the transform */
+      if (ntones)
+	{
+	  goertzel_bank(fftinbuf, fftlen, tonefreq, ntones, fsamp * 1e6 / downsample, tonepow);
+	  continue;
+	}
+
       fftwf_execute(p); 
       if (swap) swap_freq(fftoutbuf,fftlen); 
+
+      /* complex channel outputs are written one transform at a time */
+      if (complexout)
+	{
+	  if (2 * fftlen != fwrite(fftoutbuf,sizeof(float),2 * fftlen,fpoutput))
+	    fprintf(stderr,"Write error\n");
+	  counter++;
+	  continue;
+	}
+
       vector_power(fftoutbuf,fftlen);
-      
-      /* sum transforms */
+
+      /* sum transforms, via the spectral kurtosis test if requested */
+      if (skblock)
+	{
+	  for (j = 0; j < fftlen; j++)
+	    {
+	      sks1[j] += fftoutbuf[j];
+	      sks2[j] += fftoutbuf[j] * fftoutbuf[j];
+	    }
+	  if ((i + 1) % skblock == 0)
+	    {
+	      skflagged += kurtosis_excision(sks1, sks2, total, skcount, fftlen, skblock, sknsigma);
+	      skblocks  += fftlen;
+	      fold_sum(master, total, fftlen);
+	    }
+	  continue;
+	}
+
       for (j = 0; j < fftlen; j++)
 	total[j] += fftoutbuf[j];
+      if ((i + 1) % ACCUM_BLOCK == 0)
+	fold_sum(master, total, fftlen);
+
+      /* save integration state periodically */
+      if (ckptfile[0] != '-' && time(NULL) >= nextckpt)
+	{
+	  fold_sum(master, total, fftlen);
+	  ckpt.ntransforms = i + 1;
+	  ckpt.offset = input->offset;
+	  write_checkpoint(ckptfile, &ckpt, master);
+	  nextckpt = time(NULL) + CKPT_INTERVAL;
+	}
+    }
+
+  /* fold the last partial block */
+  fold_sum(master, total, fftlen);
+
+  /* save completed integration so that it can be summed with others */
+  if (ckptfile[0] != '-' && !timeseries)
+    {
+      ckpt.ntransforms = sum;
+      ckpt.offset = input ? input->offset : 0;
+      write_checkpoint(ckptfile, &ckpt, master);
+    }
+
+  /* a worker's integration is summed by the parent process */
+  if (worker >= 0 && !timeseries) exit(0);
+
+  /* complex channel outputs have already been written */
+  if (complexout) goto loop;
+
+  /* tone bank powers are written one time step at a time */
+  if (ntones)
+    {
+      if (binary)
+	{
+	  if (ntones != fwrite(tonepow,sizeof(float),ntones,fpoutput))
+	    fprintf(stderr,"Write error\n");
+	}
+      else
+	{
+	  fprintf(fpoutput,"%.6f",counter * sum / freqres);
+	  for (k = 0; k < ntones; k++)
+	    fprintf(fpoutput," % .3e",tonepow[k]);
+	  fprintf(fpoutput,"\n");
+	}
+      fflush(fpoutput);
+      counter++;
+      goto loop;
     }
   
+  /* output is single precision */
+  for (j = 0; j < fftlen; j++)
+    total[j] = master[j];
+
+  /* rescale channels that lost blocks to spectral kurtosis */
+  if (skblock)
+    {
+      for (j = 0; j < fftlen; j++)
+	total[j] = skcount[j] ? total[j] * sum / skcount[j] : 0;
+      if (!timeseries)
+	fprintf(stderr,"Spectral kurtosis left out %.3f%% of channel blocks\n",100.0 * skflagged / skblocks);
+    }
+
   /* set DC to average of neighboring values  */
   total[fftlen/2] = (total[fftlen/2-1]+total[fftlen/2+1]) / 2.0; 
 
@@ -446,16 +997,75 @@ int main(int argc, char *argv[])
   if (timeseries)
     {
       for (i = 0; i < fftlen; i++) total[i] = (total[i]-mean)/sigma;
-      if (fftlen != fwrite(total,sizeof(float),fftlen,fpoutput))
-	fprintf(stderr,"Write error\n");
-      fflush(fpoutput);
+
+      /* keep only the strongest channels, one per group of adjacent
+	 channels above threshold so that the leakage of a strong signal
+	 does not crowd out weaker ones */
+      if (maxcand)
+	{
+	  cand.time = counter * sum / freqres;
+	  cand.drift = 0;
+	  ingroup = 0;
+	  for (i = 0; i < fftlen; i++)
+	    {
+	      freq = (i-fftlen/2)*freqres;
+	      above = 0;
+	      if ((freqmin == 0.0 && freqmax == 0.0) || (freq >= freqmin && freq <= freqmax))
+		{
+		  nsearched++;
+		  if (total[i] > snrmax) snrmax = total[i];
+		  above = (total[i] >= snrmin);
+		}
+	      if (!above)
+		{
+		  if (ingroup)
+		    cand_push(candheap, &ncand, maxcand, &cand);
+		  ingroup = 0;
+		  continue;
+		}
+	      if (!ingroup || total[i] > cand.snr)
+		{
+		  cand.freq = freq;
+		  cand.snr  = total[i];
+		}
+	      if (!ingroup)
+		ngroups++;
+	      ingroup = 1;
+	      nabove++;
+	    }
+	  if (ingroup)
+	    cand_push(candheap, &ncand, maxcand, &cand);
+	  nspectra++;
+	  counter++;
+	  goto loop;
+	}
+
+      if (qbits)
+	{
+	  /* quantize into batch, write when full */
+	  quantize_spectrum(total, fftlen, qbits, &qbuf[(long) qfill * fftlen * qbits / 8], &qscale[2 * qfill]);
+	  if (++qfill == qbatch) flush_waterfall(fftlen, qbits);
+	}
+      else if (spec)
+	{
+	  if (spec_write(spec, total) != 0)
+	    fprintf(stderr,"Write error\n");
+	  fflush(fpoutput);
+	}
+      else
+	{
+	  if (fftlen != fwrite(total,sizeof(float),fftlen,fpoutput))
+	    fprintf(stderr,"Write error\n");
+	  fflush(fpoutput);
+	}
       counter++;
       goto loop;
     }
   /* or standard output */
   /* or limited frequency range */
   else
-    for (i = 0; i < fftlen; i++)
+    {
+      for (i = 0, k = 0; i < fftlen; i++)
       {
 	  freq = (i-fftlen/2)*freqres;
     
@@ -464,12 +1074,21 @@ int main(int argc, char *argv[])
 	    value = (total[i]-mean)/sigma;
 	    if (dB) value = 10*log10(value);
 
-	    if (binary)
+	    if (spec)
+	      total[k++] = value;
+	    else if (binary)
 	      fwrite(&value,sizeof(float),1,fpoutput);
 	    else
 	      fprintf(fpoutput,"% .3f % .3e\n",freq,value);  
 	  }
       }
+      if (spec)
+	{
+	  if (spec_write(spec, total) != 0)
+	    fprintf(stderr,"Write error\n");
+	  spec_close(spec);
+	}
+    }
   
   fftwf_destroy_plan(p);
   free(fftinbuf);
@@ -500,6 +1119,551 @@ void vector_window(float *data, int len)
   return;
 }
 
+/******************************************************************************/
+/*	pfb_prototype							      */
+/******************************************************************************/
+void pfb_prototype(float *coeff, int len, int ntaps, char *pfbfilter)
+{
+  /* Computes the prototype lowpass filter of a polyphase filter bank with
+     len branches and ntaps taps per branch: a sinc of width one channel
+     tapered by the requested window, or coefficients read from a file.
+     Each coefficient is stored twice so that it can be applied directly
+     to interleaved I and Q samples.
+  */
+  FILE   *fpfilter;		/* pointer to file of filter coefficients */
+  double *h;			/* prototype filter */
+  double  x;			/* offset from filter center, in channels */
+  double  w;			/* window weight */
+  double  a;			/* window phase */
+  double  norm;			/* normalization */
+  int     m = ntaps * len;	/* length of prototype filter */
+  int     i;
+
+  h = (double *) malloc(m * sizeof(double));
+  if (!h)
+    {
+      fprintf(stderr,"Malloc error\n"); 
+      exit(1);
+    }
+
+  if (strcmp(pfbfilter,"hamming") == 0 || strcmp(pfbfilter,"hanning") == 0 ||
+      strcmp(pfbfilter,"blackman") == 0)
+    {
+      for (i = 0; i < m; i++)
+	{
+	  x = ((double) i - 0.5 * (m - 1)) / (double) len;
+	  a = 2 * M_PI * (double) i / (double) (m - 1);
+	  if (pfbfilter[0] == 'b')
+	    w = 0.42 - 0.5 * cos(a) + 0.08 * cos(2 * a);
+	  else if (pfbfilter[2] == 'm')
+	    w = 0.54 - 0.46 * cos(a);
+	  else
+	    w = 0.5 - 0.5 * cos(a);
+	  h[i] = (x == 0) ? w : w * sin(M_PI * x) / (M_PI * x);
+	}
+    }
+  else
+    {
+      fpfilter = fopen(pfbfilter,"r");
+      if (fpfilter == NULL)
+	{
+	  perror("pfb_prototype: filter coefficients file open error");
+	  exit(1);
+	}
+      for (i = 0; i < m; i++)
+	if (fscanf(fpfilter, "%lf", &h[i]) != 1)
+	  {
+	    fprintf(stderr,"Filter file %s must contain %d coefficients\n",pfbfilter,m);
+	    exit(1);
+	  }
+      fclose(fpfilter);
+    }
+
+  /* unit gain per branch on average, as for a plain transform */
+  for (i = 0, norm = 0; i < m; i++)
+    norm += h[i];
+  norm = len / norm;
+
+  for (i = 0; i < m; i++)
+    coeff[2*i] = coeff[2*i+1] = (float) (h[i] * norm);
+
+  free(h);
+  return;
+}
+
+/******************************************************************************/
+/*	pfb_fir								      */
+/******************************************************************************/
+void pfb_fir(float *hist, float *coeff, float *data, int len, int ntaps, int newest)
+{
+  /* Computes the polyphase filter bank input for one transform: the sum
+     over the last ntaps blocks of len complex samples, oldest first, each
+     weighted by the corresponding segment of the prototype filter.
+     hist holds ntaps blocks in circular order with the newest in slot newest.
+     The inner loop runs over contiguous floats and is vectorized by the
+     compiler.
+  */
+  float *x, *h;
+  int    p, j, slot;
+
+  zerofill(data, 2 * len);
+  for (p = 0; p < ntaps; p++)
+    {
+      slot = (newest + 1 + p) % ntaps;
+      x = &hist[2 * len * slot];
+      h = &coeff[2 * len * p];
+      for (j = 0; j < 2 * len; j++)
+	data[j] += h[j] * x[j];
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	write_checkpoint						      */
+/******************************************************************************/
+void write_checkpoint(char *ckptfile, struct CHECKPOINT *ckpt, double *total)
+{
+  /* Saves the integration state to ckptfile.  The state is written to a
+     temporary file, flushed to disk, which then replaces ckptfile, so
+     that an interruption or a crash never leaves a partial checkpoint
+     behind.
+  */
+  FILE *fpckpt;
+  char  tmpfile[512];
+
+  snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", ckptfile);
+  fpckpt = fopen(tmpfile,"w");
+  if (fpckpt == NULL)
+    {
+      perror("write_checkpoint: checkpoint file open error");
+      return;
+    }
+  if (fwrite(ckpt, sizeof(struct CHECKPOINT), 1, fpckpt) != 1 ||
+      fwrite(total, sizeof(double), ckpt->fftlen, fpckpt) != ckpt->fftlen ||
+      fflush(fpckpt) != 0 || fsync(fileno(fpckpt)) != 0)
+    {
+      fprintf(stderr,"Write error on checkpoint file %s\n",tmpfile);
+      fclose(fpckpt);
+      return;
+    }
+  if (fclose(fpckpt) != 0)
+    {
+      fprintf(stderr,"Write error on checkpoint file %s\n",tmpfile);
+      return;
+    }
+  if (rename(tmpfile, ckptfile) != 0)
+    perror("write_checkpoint: rename");
+
+  return;
+}
+
+/******************************************************************************/
+/*	read_checkpoint							      */
+/******************************************************************************/
+long long read_checkpoint(char *ckptfile, struct CHECKPOINT *ckpt, double *total)
+{
+  /* Adds the sum of transforms saved in ckptfile to total, after verifying
+     that the checkpoint was obtained with the processing parameters in ckpt.
+     Sets the input offset in ckpt and returns the number of transforms.
+  */
+  FILE  *fpckpt;
+  struct CHECKPOINT saved;
+  double value;
+  int    i;
+
+  fpckpt = fopen(ckptfile,"r");
+  if (fpckpt == NULL)
+    {
+      perror("read_checkpoint: checkpoint file open error");
+      exit(1);
+    }
+  if (fread(&saved, sizeof(saved), 1, fpckpt) != 1 || strcmp(saved.magic, "PFSCKP2") != 0 ||
+      saved.size != sizeof(saved))
+    {
+      fprintf(stderr,"%s is not a valid checkpoint file\n",ckptfile);
+      exit(1);
+    }
+  if (saved.mode != ckpt->mode || saved.chan != ckpt->chan ||
+      saved.downsample != ckpt->downsample || saved.fftlen != ckpt->fftlen ||
+      saved.ntaps != ckpt->ntaps || saved.invert != ckpt->invert ||
+      saved.hanning != ckpt->hanning || saved.fsamp != ckpt->fsamp ||
+      saved.freqres != ckpt->freqres || strcmp(saved.pfbfilter, ckpt->pfbfilter) != 0)
+    {
+      fprintf(stderr,"Checkpoint file %s was obtained with different parameters\n",ckptfile);
+      exit(1);
+    }
+  for (i = 0; i < ckpt->fftlen; i++)
+    {
+      if (fread(&value, sizeof(double), 1, fpckpt) != 1)
+	{
+	  fprintf(stderr,"Read error on checkpoint file %s\n",ckptfile);
+	  exit(1);
+	}
+      total[i] += value;
+    }
+  fclose(fpckpt);
+
+  ckpt->offset = saved.offset;
+  return saved.ntransforms;
+}
+
+/******************************************************************************/
+/*	write_filterbank_header						      */
+/******************************************************************************/
+void write_filterbank_header(FILE *fp, char *infile, int len, double freqres, double tsamp, int nbits)
+{
+  /* Writes a SIGPROC filterbank header: each keyword is a string preceded
+     by its length as an int, followed by its binary value.
+     Channel frequencies are offsets from the center of the band, in
+     increasing order, as in the other pfs_fft outputs.
+  */
+  char  *keys[] = {"HEADER_START", "rawdatafile", "data_type", "fch1", "foff",
+		   "nchans", "nbits", "nifs", "tstart", "tsamp", "HEADER_END"};
+  int    ivalue;
+  double dvalue;
+  int    n, k;
+
+  for (k = 0; k < 11; k++)
+    {
+      n = strlen(keys[k]);
+      fwrite(&n, sizeof(int), 1, fp);
+      fwrite(keys[k], 1, n, fp);
+      switch (k)
+	{
+	case 1:			/* rawdatafile */
+	  n = strlen(infile);
+	  fwrite(&n, sizeof(int), 1, fp);
+	  fwrite(infile, 1, n, fp);
+	  break;
+	case 2:			/* data_type: filterbank */
+	case 7:			/* nifs */
+	  ivalue = 1;
+	  fwrite(&ivalue, sizeof(int), 1, fp);
+	  break;
+	case 3:			/* fch1, MHz */
+	  dvalue = -len/2 * freqres / 1e6;
+	  fwrite(&dvalue, sizeof(double), 1, fp);
+	  break;
+	case 4:			/* foff, MHz */
+	  dvalue = freqres / 1e6;
+	  fwrite(&dvalue, sizeof(double), 1, fp);
+	  break;
+	case 5:			/* nchans */
+	  fwrite(&len, sizeof(int), 1, fp);
+	  break;
+	case 6:			/* nbits */
+	  fwrite(&nbits, sizeof(int), 1, fp);
+	  break;
+	case 8:			/* tstart, MJD, unknown */
+	  dvalue = 0;
+	  fwrite(&dvalue, sizeof(double), 1, fp);
+	  break;
+	case 9:			/* tsamp, s */
+	  fwrite(&tsamp, sizeof(double), 1, fp);
+	  break;
+	}
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	quantize_spectrum						      */
+/******************************************************************************/
+void quantize_spectrum(float *data, int len, int nbits, unsigned char *out, float *offscale)
+{
+  /* Quantizes the spectrum data of len channels to nbits unsigned
+     integers spanning its full range.  offscale receives the offset and
+     scale that restore the values: data = offset + scale * out.
+  */
+  unsigned short *out16 = (unsigned short *) out;
+  float  min, max, scale, inv;
+  int    levels = (1 << nbits) - 1;
+  int    i;
+
+  min = max = data[0];
+  for (i = 1; i < len; i++)
+    {
+      if (data[i] < min) min = data[i];
+      if (data[i] > max) max = data[i];
+    }
+  scale = (max > min) ? (max - min) / levels : 1;
+  inv   = 1.0 / scale;
+
+  if (nbits == 8)
+    for (i = 0; i < len; i++)
+      out[i] = (unsigned char) ((data[i] - min) * inv + 0.5);
+  else
+    for (i = 0; i < len; i++)
+      out16[i] = (unsigned short) ((data[i] - min) * inv + 0.5);
+
+  offscale[0] = min;
+  offscale[1] = scale;
+  return;
+}
+
+/******************************************************************************/
+/*	flush_waterfall							      */
+/******************************************************************************/
+void flush_waterfall(int len, int nbits)
+{
+  /* writes the batch of quantized spectra and their offsets and scales */
+  long nbytes = (long) qfill * len * nbits / 8;
+
+  if (qfill == 0) return;
+
+  if (nbytes != fwrite(qbuf, 1, nbytes, fpoutput) ||
+      2 * qfill != fwrite(qscale, sizeof(float), 2 * qfill, fpscale))
+    fprintf(stderr,"Write error\n");
+  fflush(fpoutput);
+  fflush(fpscale);
+  qfill = 0;
+  return;
+}
+
+/******************************************************************************/
+/*	goertzel_bank							      */
+/******************************************************************************/
+void goertzel_bank(float *data, int len, double *tonefreq, int ntones, double fs, float *power)
+{
+  /* Adds to power[k] the power of the discrete Fourier transform of the
+     len complex samples in data at frequency tonefreq[k] (Hz), for
+     sampling frequency fs (Hz).  The Goertzel recursion
+	s[n] = x[n] + 2 cos(w) s[n-1] - s[n-2]
+     costs one real multiplication per I or Q sample and frequency, and
+     |X(w)|^2 = |s[N-1] - exp(-iw) s[N-2]|^2.  The recursion runs in double
+     precision over all frequencies at once, an inner loop the compiler
+     vectorizes.
+  */
+  double coef[MAXTONES];
+  double s1r[MAXTONES], s1i[MAXTONES];
+  double s2r[MAXTONES], s2i[MAXTONES];
+  double s0r, s0i, yr, yi, w;
+  double xr, xi;
+  int    n, k;
+
+  for (k = 0; k < ntones; k++)
+    {
+      coef[k] = 2 * cos(2 * M_PI * tonefreq[k] / fs);
+      s1r[k] = s1i[k] = s2r[k] = s2i[k] = 0;
+    }
+
+  for (n = 0; n < len; n++)
+    {
+      xr = data[2*n];
+      xi = data[2*n+1];
+      for (k = 0; k < ntones; k++)
+	{
+	  s0r = xr + coef[k] * s1r[k] - s2r[k];
+	  s0i = xi + coef[k] * s1i[k] - s2i[k];
+	  s2r[k] = s1r[k];
+	  s2i[k] = s1i[k];
+	  s1r[k] = s0r;
+	  s1i[k] = s0i;
+	}
+    }
+
+  for (k = 0; k < ntones; k++)
+    {
+      w  = 2 * M_PI * tonefreq[k] / fs;
+      yr = s1r[k] - (cos(w) * s2r[k] + sin(w) * s2i[k]);
+      yi = s1i[k] - (cos(w) * s2i[k] - sin(w) * s2r[k]);
+      power[k] += yr * yr + yi * yi;
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	kurtosis_excision						      */
+/******************************************************************************/
+int kurtosis_excision(float *s1, float *s2, float *total, float *count, int len, int m, float nsigma)
+{
+  /* Computes the spectral kurtosis estimator
+	SK = (M+1)/(M-1) (M S2 / S1^2 - 1)
+     of each of the len channels from the sums s1 of M powers and s2 of
+     their squares, adds the block to total and M to count for channels
+     less than nsigma above the Gaussian noise expectation SK = 1
+     (variance 4 M^2 / ((M-1)(M+2)(M+3))), and clears s1 and s2 for the
+     next block.  Only impulsive signals raise SK; a steady carrier
+     lowers it towards 0 and is kept.
+     The whole block is left out if more than half the channels are
+     flagged.  Returns the number of channels left out.
+  */
+  float  limit;			/* largest allowed SK - 1 */
+  float  sk;			/* spectral kurtosis estimator */
+  double M = m;
+  int    flagged = 0;
+  int    j;
+
+  limit = nsigma * sqrt(4 * M * M / ((M - 1) * (M + 2) * (M + 3)));
+
+  /* flag channels, marking them with a negative s2 */
+  for (j = 0; j < len; j++)
+    {
+      sk = (M + 1) / (M - 1) * (M * s2[j] / (s1[j] * s1[j]) - 1);
+      if (!(sk - 1 <= limit))
+	{
+	  s2[j] = -1;
+	  flagged++;
+	}
+    }
+
+  if (2 * flagged > len)
+    flagged = len;
+  else
+    for (j = 0; j < len; j++)
+      if (s2[j] >= 0)
+	{
+	  total[j] += s1[j];
+	  count[j] += m;
+	}
+
+  zerofill(s1, len);
+  zerofill(s2, len);
+  return flagged;
+}
+
+/******************************************************************************/
+/*	write_candidates						      */
+/******************************************************************************/
+void write_candidates(void)
+{
+  /* writes summary statistics and the candidates, strongest first */
+  int i;
+
+  cand_sort(candheap, ncand);
+  fprintf(fpoutput,"# integrations searched       : %d\n",nspectra);
+  fprintf(fpoutput,"# channels searched           : %lld\n",nsearched);
+  fprintf(fpoutput,"# channels above %8.2f     : %lld\n",snrmin,nabove);
+  fprintf(fpoutput,"# groups of adjacent channels : %lld\n",ngroups);
+  fprintf(fpoutput,"# strongest channel (sigmas)  : %.2f\n",snrmax);
+  fprintf(fpoutput,"# candidates written          : %d\n",ncand);
+  fprintf(fpoutput,"#   time (s)       freq (Hz)      SNR\n");
+  for (i = 0; i < ncand; i++)
+    fprintf(fpoutput,"%12.6f % .6e %8.2f\n",candheap[i].time,candheap[i].freq,candheap[i].snr);
+  fflush(fpoutput);
+  ncand = 0;
+  return;
+}
+
+/******************************************************************************/
+/*	spawn_workers							      */
+/******************************************************************************/
+int spawn_workers(int nworkers)
+{
+  /* forks nworkers worker processes
+     returns the worker number in each worker, and -1 in the parent once
+     all workers have completed successfully
+  */
+  pid_t  pid[MAXWORKERS];
+  char   name[WORKERFILE_LEN];
+  int    n;
+  int    status;
+  int    failed = 0;
+  int    k;
+
+  /* worker outputs are kept next to the output file, or in TMPDIR */
+  if (strcmp(outfile, "-") != 0)
+    n = snprintf(workerbase, sizeof(workerbase), "%s.part", outfile);
+  else
+    n = snprintf(workerbase, sizeof(workerbase), "%s/pfs_fft.%d",
+		 getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int) getpid());
+  if (n < 0 || n >= (int) sizeof(workerbase))
+    {
+      fprintf(stderr,"Worker output file name too long\n");
+      exit(1);
+    }
+
+  fflush(NULL);
+  for (k = 0; k < nworkers; k++)
+    {
+      if ((pid[k] = fork()) < 0)
+	{
+	  perror("spawn_workers: fork");
+	  exit(1);
+	}
+      if (pid[k] == 0)
+	return k;
+    }
+
+  for (k = 0; k < nworkers; k++)
+    if (waitpid(pid[k], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed++;
+
+  if (failed)
+    {
+      fprintf(stderr,"%d of %d workers failed\n",failed,nworkers);
+      for (k = 0; k < nworkers; k++)
+	{
+	  worker_file(name, k);
+	  unlink(name);
+	}
+      exit(1);
+    }
+  return -1;
+}
+
+/******************************************************************************/
+/*	worker_file							      */
+/******************************************************************************/
+void worker_file(char *name, int k)
+{
+  /* builds the name of the output file of worker k in name, which holds
+     WORKERFILE_LEN characters
+  */
+  int n;
+
+  n = snprintf(name, WORKERFILE_LEN, "%s.%03d", workerbase, k);
+  if (n < 0 || n >= (int) WORKERFILE_LEN)
+    {
+      fprintf(stderr,"Worker output file name too long\n");
+      exit(1);
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	concat_workers							      */
+/******************************************************************************/
+void concat_workers(int nworkers)
+{
+  /* appends the time series of the workers to the output, in order, and
+     removes them
+  */
+  FILE  *fp;
+  char   name[WORKERFILE_LEN];
+  char  *buf;
+  size_t n;
+  int    k;
+
+  buf = (char *) malloc(QBATCH_BYTES);
+  if (!buf)
+    {
+      fprintf(stderr,"Malloc error\n"); 
+      exit(1);
+    }
+
+  for (k = 0; k < nworkers; k++)
+    {
+      worker_file(name, k);
+      if ((fp = fopen(name, "r")) == NULL)
+	{
+	  perror("concat_workers: open worker output");
+	  exit(1);
+	}
+      while ((n = fread(buf, 1, QBATCH_BYTES, fp)) > 0)
+	if (n != fwrite(buf, 1, n, fpoutput))
+	  {
+	    fprintf(stderr,"Write error\n");
+	    exit(1);
+	  }
+      fclose(fp);
+      unlink(name);
+    }
+  fflush(fpoutput);
+  free(buf);
+  return;
+}
+
 /******************************************************************************/
 /*	chebyshev_window						      */
 /******************************************************************************/
@@ -551,7 +1715,7 @@ double chebeval(double x, double c[], int degree)
 /******************************************************************************/
 /*	processargs							      */
 /******************************************************************************/
-void	processargs(argc,argv,infile,outfile,mode,fsamp,freqres,downsample,sum,binary,timeseries,chan,freqmin,freqmax,rmsmin,rmsmax,dB,invert,hanning,chebfile,nskipseconds)
+void	processargs(argc,argv,infile,outfile,mode,fsamp,freqres,downsample,sum,binary,timeseries,chan,freqmin,freqmax,rmsmin,rmsmax,dB,invert,hanning,chebfile,nskipseconds,ntaps,pfbfilter,complexout,follow,ckptfile,resume,mergefiles,qbits,tonefreq,ntones,skblock,sknsigma,snrmin,maxcand,allfiles,nworkers,modelfile,container)
 int	argc;
 char	**argv;			 /* command line arguements */
 char	**infile;		 /* input file name */
@@ -573,6 +1737,24 @@ int     *invert;
 int     *hanning;
 char    **chebfile;
 float   *nskipseconds;
+int     *ntaps;
+char    **pfbfilter;
+int     *complexout;
+int     *follow;
+char    **ckptfile;
+int     *resume;
+char    **mergefiles;
+int     *qbits;
+double  *tonefreq;
+int     *ntones;
+int     *skblock;
+float   *sknsigma;
+float   *snrmin;
+int     *maxcand;
+int     *allfiles;
+int     *nworkers;
+char    **modelfile;
+int     *container;
 {
   /* function to process a programs input command line.
      This is a template which has been customised for the pfs_fft program:
@@ -585,11 +1767,12 @@ float   *nskipseconds;
   extern int optind;	/* after call, ind into argv for next*/
   extern int opterr;    /* if 0, getopt won't output err mesg*/
 
-  char *myoptions = "m:f:d:r:n:tc:o:lbx:s:iHC:S:"; /* options to search for :=> argument*/
-  char *USAGE1="pfs_fft -m mode -f sampling frequency (MHz) [-r desired frequency resolution (Hz)] [-d downsampling factor] [-n sum n transforms] [-l (dB output)] [-b (binary output)] [-t time series] [-x freqmin,freqmax (Hz)] [-s scale to sigmas using smin,smax (Hz)] [-c channel (1 or 2)] [-i swap IQ before transform (invert freq axis)] [-w apply Hanning window before transform] [-C file of Chebyshev polynomial coefficients defining window to apply after transform] [-S number of seconds to skip before applying first FFT] [-o outfile] [infile]";
+  char *myoptions = "m:f:d:r:n:tc:o:lbx:s:iHC:S:P:F:zw:k:RM:q:g:K:D:aj:X:e"; /* options to search for :=> argument*/
+  char *USAGE1="pfs_fft -m mode -f sampling frequency (MHz) [-r desired frequency resolution (Hz)] [-d downsampling factor] [-n sum n transforms] [-l (dB output)] [-b (binary output)] [-t time series] [-x freqmin,freqmax (Hz)] [-s scale to sigmas using smin,smax (Hz)] [-c channel (1 or 2)] [-i swap IQ before transform (invert freq axis)] [-H apply Hanning window before transform] [-C file of Chebyshev polynomial coefficients defining window to apply after transform] [-S number of seconds to skip before applying first FFT] [-P polyphase filter bank taps per branch] [-F prototype filter (hamming, hanning, blackman, or file)] [-z (complex channel output)] [-w follow growing file, stop after w idle seconds] [-k checkpoint file] [-R (resume from checkpoint)] [-M ckptfile1,ckptfile2,... (sum checkpoints)] [-q 8 or 16 bit filterbank time series] [-g f1,f2,... (Hz) tone bank] [-K M,nsigma spectral kurtosis] [-D snrmin,K candidate detection] [-a (all files of series)] [-j worker processes] [-X frequency model file] [-e (file of spectra with header and index)] [-o outfile] [infile (- for stdin)]";
   char *USAGE2="Valid modes are\n\t 0: 2c1b (N/A)\n\t 1: 2c2b\n\t 2: 2c4b\n\t 3: 2c8b\n\t 4: 4c1b (N/A)\n\t 5: 4c2b\n\t 6: 4c4b\n\t 7: 4c8b (N/A)\n\t 8: signed bytes\n\t16: signed 16bit\n\t32: 32bit floats\n";
   int  c;			 /* option letter returned by getopt  */
   int  arg_count = 1;		 /* optioned argument count */
+  char *tone;			 /* one of the -g frequencies */
 
   /* default parameters */
   opterr = 0;			 /* turn off there message */
@@ -609,6 +1792,22 @@ float   *nskipseconds;
   *hanning = 0;
   *chebfile = "-";
   *nskipseconds = 0;    /* default is process entire file */
+  *ntaps = 0;		/* default is plain transform */
+  *pfbfilter = "hamming";
+  *complexout = 0;
+  *follow = 0;
+  *ckptfile = "-";	/* default is no checkpoints */
+  *resume = 0;
+  *mergefiles = "-";
+  *qbits = 0;		/* default is floating point time series */
+  *ntones = 0;		/* default is full transform */
+  *skblock = 0;		/* default is no spectral kurtosis excision */
+  *sknsigma = 3;
+  *maxcand = 0;		/* default is no candidate detection */
+  *allfiles = 0;	/* default is a single file */
+  *nworkers = 1;	/* default is a single process */
+  *modelfile = "-";	/* default is no frequency compensation */
+  *container = 0;	/* default is bare output */
   *freqmin = 0;		/* not set value */
   *freqmax = 0;		/* not set value */
   *rmsmin  = 0;		/* not set value */
@@ -684,6 +1883,94 @@ float   *nskipseconds;
 	arg_count += 1;
 	break;
 
+      case 'P':
+	sscanf(optarg,"%d",ntaps);
+	arg_count += 2;
+	break;
+
+      case 'F':
+	*pfbfilter = optarg;	/* prototype filter name or file */
+	arg_count += 2;
+	break;
+
+      case 'z':
+	*complexout = 1;
+	arg_count += 1;
+	break;
+
+      case 'w':
+	sscanf(optarg,"%d",follow);
+	arg_count += 2;
+	break;
+
+      case 'X':
+	*modelfile = optarg;	/* file of frequency model */
+	arg_count += 2;
+	break;
+
+      case 'e':
+	*container = 1;
+	*binary = 1;
+	arg_count += 1;
+	break;
+
+      case 'a':
+	*allfiles = 1;
+	arg_count += 1;
+	break;
+
+      case 'j':
+	sscanf(optarg,"%d",nworkers);
+	arg_count += 2;
+	break;
+
+      case 'k':
+	*ckptfile = optarg;	/* checkpoint file name */
+	arg_count += 2;
+	break;
+
+      case 'R':
+	*resume = 1;
+	arg_count += 1;
+	break;
+
+      case 'M':
+	*mergefiles = optarg;	/* checkpoint files to sum */
+	arg_count += 2;
+	break;
+
+      case 'q':
+	sscanf(optarg,"%d",qbits);
+	arg_count += 2;
+	break;
+
+      case 'D':
+	*maxcand = 100;
+	if (sscanf(optarg,"%f,%d",snrmin,maxcand) < 1)
+	  goto errout;
+	arg_count += 2;
+	break;
+
+      case 'K':
+	if (sscanf(optarg,"%d,%f",skblock,sknsigma) < 1)
+	  goto errout;
+	arg_count += 2;
+	break;
+
+      case 'g':
+	for (tone = strtok(optarg, ","); tone; tone = strtok(NULL, ","))
+	  {
+	    if (*ntones == MAXTONES)
+	      {
+		fprintf(stderr,"\nERROR: at most %d -g frequencies\n",MAXTONES);
+		goto errout;
+	      }
+	    if (sscanf(tone,"%lf",&tonefreq[(*ntones)++]) != 1)
+	      goto errout;
+	  }
+	arg_count += 2;
+	break;
+
       case 't':
 	*timeseries = 1;
 	arg_count += 1;
@@ -746,17 +2033,102 @@ float   *nskipseconds;
       fprintf(stderr,"Cannot have -t and -l simultaneously yet\n");
       goto errout;
     }
-  if (*timeseries && (*freqmin != 0 || *freqmax !=0)) 
+  if (*timeseries && (*freqmin != 0 || *freqmax !=0) && !*maxcand) 
     {
       fprintf(stderr,"Cannot have -t and -x simultaneously yet\n");
       goto errout;
     }
-  if (*downsample > 1 && (*mode == 16 || *mode == 32)) 
+  if (*ntaps < 0) goto errout;
+  if (*ntaps && *hanning)
+    {
+      fprintf(stderr,"Cannot have -H and -P simultaneously\n");
+      goto errout;
+    }
+  if (*complexout && (*sum != 1 || *dB || *freqmin != 0 || *freqmax != 0 || *rmsmin != 0 || *rmsmax != 0))
+    {
+      fprintf(stderr,"Cannot have -z with -n, -l, -x, or -s\n");
+      goto errout;
+    }
+  if (*follow < 0) goto errout;
+  if (*follow && strcmp(*infile,"-") == 0)
+    {
+      fprintf(stderr,"Cannot have -w with input from stdin\n");
+      goto errout;
+    }
+  if (*nworkers < 1 || *nworkers > MAXWORKERS) goto errout;
+  if ((*allfiles || *nworkers > 1) && (*follow || strcmp(*infile,"-") == 0))
+    {
+      fprintf(stderr,"Cannot have -a or -j with -w or input from stdin\n");
+      goto errout;
+    }
+  if (*nworkers > 1 && (*ckptfile[0] != '-' || *resume || *mergefiles[0] != '-' ||
+			*qbits || *maxcand || *ntones || *skblock))
+    {
+      fprintf(stderr,"Cannot have -j with -k, -R, -M, -q, -D, -g, or -K\n");
+      goto errout;
+    }
+
+  if ((*ckptfile[0] != '-' || *resume || *mergefiles[0] != '-') && (*timeseries || *complexout || *maxcand))
+    {
+      fprintf(stderr,"Cannot have -k, -R, or -M with -t, -z, or -D\n");
+      goto errout;
+    }
+  if (*resume && (*ckptfile[0] == '-' || *mergefiles[0] != '-'))
+    {
+      fprintf(stderr,"Must specify -k checkpoint file and no -M with -R\n");
+      goto errout;
+    }
+
+  if (*qbits && (*qbits != 8 && *qbits != 16))
+    {
+      fprintf(stderr,"Filterbank output requires 8 or 16 bits\n");
+      goto errout;
+    }
+  if (*qbits && (!*timeseries || *complexout || (*outfile)[0] == '-'))
+    {
+      fprintf(stderr,"Must specify -t and -o outfile and no -z with -q\n");
+      goto errout;
+    }
+
+  if (*ntones && (*ntaps || *complexout || *qbits || *dB || *freqmin != 0 || *freqmax != 0 ||
+		  *rmsmin != 0 || *rmsmax != 0 || *ckptfile[0] != '-' || *mergefiles[0] != '-'))
+    {
+      fprintf(stderr,"Cannot have -g with -P, -z, -q, -l, -x, -s, -k, or -M\n");
+      goto errout;
+    }
+
+  if (*maxcand && (*maxcand < 1 || (*rmsmin == 0 && *rmsmax == 0)))
+    {
+      fprintf(stderr,"-D requires -s and at least one candidate\n");
+      goto errout;
+    }
+  if (*maxcand && (*dB || *complexout || *qbits || *ntones))
+    {
+      fprintf(stderr,"Cannot have -D with -l, -z, -q, or -g\n");
+      goto errout;
+    }
+  if (*maxcand) *timeseries = 1;
+
+  if (*skblock && (*skblock < 2 || *sknsigma <= 0 || *sum % *skblock != 0))
+    {
+      fprintf(stderr,"-K block must be at least 2 and divide -n\n");
+      goto errout;
+    }
+  if (*skblock && (*complexout || *ntones || *ckptfile[0] != '-' || *mergefiles[0] != '-'))
+    {
+      fprintf(stderr,"Cannot have -K with -z, -g, -k, or -M\n");
+      goto errout;
+    }
+
+  if (*container && (*complexout || *qbits || *ntones || *maxcand))
     {
-      fprintf(stderr,"Cannot have -d with modes 16 or 32 yet\n");
-      exit (1);
+      fprintf(stderr,"Cannot have -e with -z, -q, -g, or -D\n");
+      goto errout;
     }
 
+  /* complex outputs are written as a time series */
+  if (*complexout) *timeseries = 1;
+
   return;
 
   /* here if illegal option or argument */
@@ -838,6 +2210,70 @@ char	command_line[];		/* command line parameters in single string */
   return;
 }	
 
+/******************************************************************************/
+/*	downsample_int16						      */
+/******************************************************************************/
+void downsample_int16(short *in, float *out, int len, int downsample)
+{
+  /* Converts len * downsample complex 16 bit samples to floats and sums
+     each group of downsample consecutive samples coherently into the len
+     complex samples of out.
+  */
+  float re, im;
+  int   k, j;
+
+  if (downsample == 1)
+    {
+      for (k = 0; k < 2*len; k++)
+	out[k] = (float) in[k];
+      return;
+    }
+
+  for (k = 0; k < len; k++, in += 2*downsample)
+    {
+      re = im = 0;
+      for (j = 0; j < 2*downsample; j += 2)
+	{
+	  re += (float) in[j];
+	  im += (float) in[j+1];
+	}
+      out[2*k]   = re;
+      out[2*k+1] = im;
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	downsample_float						      */
+/******************************************************************************/
+void downsample_float(float *in, float *out, int len, int downsample)
+{
+  /* Sums each group of downsample consecutive complex float samples
+     coherently into the len complex samples of out.
+  */
+  float re, im;
+  int   k, j;
+
+  if (downsample == 1)
+    {
+      memcpy(out, in, 2 * len * sizeof(float));
+      return;
+    }
+
+  for (k = 0; k < len; k++, in += 2*downsample)
+    {
+      re = im = 0;
+      for (j = 0; j < 2*downsample; j += 2)
+	{
+	  re += in[j];
+	  im += in[j+1];
+	}
+      out[2*k]   = re;
+      out[2*k+1] = im;
+    }
+  return;
+}
+
 /******************************************************************************/
 /*	vector_power							      */
 /******************************************************************************/
@@ -913,6 +2349,27 @@ void zerofill(float *data, int len)
   return;
 }
 
+/******************************************************************************/
+/*	fold_sum							      */
+/******************************************************************************/
+void fold_sum(double *sum, float *block, int len)
+{
+  /* adds the float block sums to the double precision sums and zeroes
+     the block, so that long integrations do not lose the contributions
+     of individual transforms to rounding
+  */
+
+  int i;
+
+  for (i=0; i<len; i++)
+    {
+      sum[i]  += block[i];
+      block[i] = 0.0;
+    }
+
+  return;
+}
+
 /******************************************************************************/
 /*	no_comma_in_string						      */
 /******************************************************************************/
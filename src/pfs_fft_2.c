@@ -3,7 +3,9 @@
 *  $Id: pfs_fft_2.c,v 4.2 2020/05/21 17:47:53 jlm Exp $
 *  This programs performs spectral analysis on data acquired with the portable
 *  fast sampler (PFS), JPL clones of the PFS, and other data-taking devices.
-*  It sums the powers obtained in two channels.
+*  It sums the powers obtained in two or more channels, optionally with
+*  weights, or writes the power of each channel, or forms the Stokes
+*  parameters of pairs of channels.
 *
 *  usage:
 *  	pfs_fft -m mode 
@@ -21,7 +23,12 @@
 *              [-H apply Hanning window before transform]
 *              [-C file of Chebyshev polynomial coefficients defining window to apply after transform] 
 *              [-S number of seconds to skip before applying first FFT]
-*              [-o outfile] [infile]
+*              [-w w1,w2,... weights of the inputs]
+*              [-p (write the power of each input)]
+*              [-Q stokes|products (polarization of input pairs)]
+*              [-D (rcp and lcp of each input file, modes 5 and 6)]
+*              [-T number of threads]
+*              [-o outfile] infile1 infile2 ...
 *
 *  input:
 *       the input parameters are typed in as command line arguments
@@ -36,6 +43,39 @@
 *			one after the other until EOF
 *       the -x option specifies an optional range of output frequencies
 *       the -c argument specifies which channel (1 or 2) to process
+*       the -w argument replaces the sum of powers by a weighted sum, with
+*                       one weight per input file
+*       the -p option writes the power of each input instead of their sum:
+*                       one column per input in text output, and one
+*                       spectrum per input, in order, in binary and time
+*                       series output
+*       the -Q argument treats the first and second inputs, the third and
+*                       fourth, ... as the rcp (r) and lcp (l) channels of
+*                       pairs and also sums their cross products r l*,
+*                       from the same transforms; each pair then gives
+*                       four spectra, either the Stokes parameters
+*                         I = rr + ll, Q = 2 Re(r l*), U = -2 Im(r l*),
+*                         V = rr - ll
+*                       or the raw products rr, ll, Re(r l*), Im(r l*),
+*                       in that order; -w then weights the pairs, and
+*                       the four spectra of the (weighted) sum of pairs,
+*                       or with -p of each pair, are written as four
+*                       inputs would be
+*       the -D option, in modes 5 and 6, reads each input file once and
+*                       decodes both of its channels from the same
+*                       buffer, as an rcp input followed by an lcp input;
+*                       -w, -p and -Q then see twice as many inputs, so
+*                       that -D -Q stokes gives the Stokes parameters of
+*                       a single file
+*       the -T argument specifies the number of threads transforming the
+*                       inputs, default one per processor, started once
+*                       and given every batch; each input
+*                       file is also read ahead by a thread of its own,
+*                       into STREAM_SLOTS chunks of BATCH_BYTES, and
+*                       the batches are taken from memory in turn
+*       up to 64 input files may be given; in modes 5 and 6 the first,
+*                       third, ... provide rcp and the others lcp
+*       one of the input files may be a pipe, given as - for stdin
 *
 *  output:
 *	the -o option identifies the output file, stdout is default
@@ -66,54 +106,116 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "unpack.h"
+#include "streamfile.h"
 #include <fftw3.h>
 
 /* revision control variable */
 static char const rcsid[] = 
 "$Id: pfs_fft_2.c,v 4.2 2020/05/21 17:47:53 jlm Exp $";
 
+#define MAXINPUTS 64		/* maximum number of input files */
+
 FILE   *fpoutput;		/* pointer to output file */
-int	fdinput1;		/* file descriptor for input file 1 */
-int	fdinput2;		/* file descriptor for input file 2 */
 
 char   *outfile;		/* output file name */
-char   *infile1;	        /* input file name 1 */
-char   *infile2;	        /* input file name 2 */
+char   *infiles[MAXINPUTS];	/* input file names */
 char   *chebfile;	        /* file of Chebyshev coefficients */
 
 char	command_line[512];	/* command line assembled by processargs */
 
+#define ACCUM_BLOCK 256		/* transforms summed in float before folding into double */
+
+#define BATCH_BYTES (4 * 1024 * 1024) /* data read from each input at once */
+
+/* one input, with its own transform and sums */
+struct FFTINPUT {
+  char   *name;			/* input file name */
+  struct STREAMFILE *input;	/* buffered input file, NULL if it shares the previous one */
+  char   *buffer;		/* batch of packed data */
+  char   *unpacked;		/* unpacked samples of one transform */
+  float  *fftinbuf;
+  float  *fftoutbuf;
+  fftwf_plan plan;
+  float  *total;		/* sum of the current block of transforms */
+  double *master;		/* sum of transforms, folded from total */
+  long long count;		/* number of transforms summed */
+  float   weight;		/* weight in the combined power */
+  float  *cross;		/* sum of a block of cross products with the next input */
+  double *xmaster;		/* sum of cross products, folded from cross */
+  float  *pol;			/* polarization spectra of the pair it starts */
+};
+
+struct FFTINPUT inputs[MAXINPUTS];
+int	ninputs;		/* number of inputs */
+
+/* parameters shared by the threads transforming the inputs */
+int	nthreads;		/* number of threads, 0 for one per processor */
+pthread_t tid[MAXINPUTS];
+int	tnum[MAXINPUTS];	/* thread numbers */
+int	mode;
+long	bufsize;		/* size of the packed data of one transform */
+int	fftlen;			/* transform length, complex samples */
+int	downsample;		/* downsampling factor, dimensionless */
+int	invert;			/* swap i and q before fft routine */
+int	hanning;		/* apply Hanning window before fft routine */
+int	swap = 1;		/* swap frequencies at output of fft routine */
+long long nbatch;		/* number of transforms in the current batch */
+long long njobs   = 0;		/* batches handed to the threads */
+int	nbusy     = 0;		/* threads still transforming the last one */
+int	workend   = 0;		/* no more batches */
+pthread_mutex_t worklock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  workcond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t  donecond = PTHREAD_COND_INITIALIZER;
+int	polar;			/* polarization of pairs of inputs, 0 for none */
+int	nunits;			/* number of inputs, or pairs with polar */
+int	dualpol;		/* each file gives an rcp and an lcp input */
+
+#define POL_STOKES   1		/* Stokes I, Q, U, V */
+#define POL_PRODUCTS 2		/* rr, ll, Re(r l*), Im(r l*) */
+
 void processargs();
 void open_file();
 void copy_cmd_line();
 void vector_power(float *data, int len);
+void downsample_int16(short *in, float *out, int len, int downsample);
+void downsample_float(float *in, float *out, int len, int downsample);
 void vector_window(float *data, int len);
 void chebyshev_window(float *data, int len, double *chebcoeff, int degree);
 void swap_freq(float *data, int len);
 void swap_iandq(float *data, int len);
 void zerofill(float *data, int len);
+void fold_sum(double *sum, float *block, int len);
 int  no_comma_in_string();	
 double chebeval(double x, double c[], int degree);
 int  read_cheb_coeffs(char *chebfile, double *chebcoeff);
+void run_batch(void);
+void *batch_worker(void *arg);
+void *transform_inputs(void *arg);
+void transform_one(struct FFTINPUT *in, int k, char *buffer);
+void cross_power(float *r, float *l, float *cross, int len);
+void polarization(float *rr, float *ll, float *cross, float *pol, int len, int polar);
+void spectrum_rms(float *data, int len, double freqres, float rmsmin, float rmsmax, double *mean, double *sigma);
 
 int main(int argc, char *argv[])
 {
-  int mode;
-  long bufsize;		/* size of read buffer */
-  char *buffer1;	/* buffer 1 for packed data */
-  char *buffer2;	/* buffer 2 for packed data */
-  char *rcp;		/* buffer for unpacked data */
-  char *lcp;		/* buffer for unpacked data */
   float smpwd;		/* # of single pol complex samples in a 4 byte word */
   int nsamples;		/* # of complex samples in each buffer */
-  int levels;		/* # of levels for given quantization mode */
   int degree=0;         /* degree of Chebyshev polynomial, default none */
 
-  float *fftinbuf1, *fftoutbuf1;
-  float *fftinbuf2, *fftoutbuf2;
-  float *total1,*total2;
-  float *total;
+  struct FFTINPUT *in;	/* one of the inputs */
+  float *total;		/* combined power of the inputs */
+  float *spectrum;	/* power being written */
+  float *outspec[4*MAXINPUTS]; /* spectra written per integration */
+  float *unitspec;	/* spectra of one input, or pair of inputs with -Q */
+  float weights[MAXINPUTS]; /* -w weights of the inputs, or pairs with -Q */
+  int nweights;		/* number of -w weights, 0 for a plain sum */
+  int perinput;		/* write the power of each input separately */
+  int nspec;		/* spectra per input, or per pair with -Q */
+  int nout;		/* number of spectra written per integration */
+  long long batch;	/* transforms read from each input at once */
+  long long done;	/* transforms summed so far */
 
   double *chebcoeff;    /* array for polynomial coefficients */
 
@@ -125,32 +227,21 @@ int main(int argc, char *argv[])
   float rmsmax;		/* max frequency for rms calculation */
   double fsamp;		/* sampling frequency, MHz */
   double freqres;	/* frequency resolution, Hz */
-  double mean,mean1;	/* needed for rms computation */
-  double var,var1;	/* needed for rms computation */
-  double sigma,sigma1;	/* needed for rms computation */
-  int downsample;	/* downsampling factor, dimensionless */
+  double mean[4*MAXINPUTS];  /* offsets of the spectra written */
+  double sigma[4*MAXINPUTS]; /* scales of the spectra written */
   long long sum;	/* number of transforms to add, dimensionless */
   int timeseries;	/* process as time series, boolean */
   int dB;		/* write out results in dB */
-  int fftlen;		/* transform length, complex samples */
   int chan;		/* channel to process (1 or 2) for dual pol data */
   int counter=0;	/* keeps track of number of transforms written */
-  int open_flags;	/* flags required for open() call */
-  int invert;		/* swap i and q before fft routine */
-  int hanning;		/* apply Hanning window before fft routine */
-  int swap = 1;		/* swap frequencies at output of fft routine */
   int binary;		/* write output as binary floating point quantities */
   float nskipseconds;     /* optional number of seconds to skip at beginning of file */
   long nskipbytes;	/* number of bytes to skip at beginning of file */
-  int imin,imax;	/* indices for rms calculation */
   
-  fftwf_plan p1;
-  fftwf_plan p2;
-  int i,j,k,l,n,n1;
-  short x;
+  int i,j,k,o;
 
   /* get the command line arguments */
-  processargs(argc,argv,&infile1,&infile2,&outfile,&mode,&fsamp,&freqres,&downsample,&sum,&binary,&timeseries,&chan,&freqmin,&freqmax,&rmsmin,&rmsmax,&dB,&invert,&hanning,&chebfile,&nskipseconds);
+  processargs(argc,argv,infiles,&ninputs,&outfile,&mode,&fsamp,&freqres,&downsample,&sum,&binary,&timeseries,&chan,&freqmin,&freqmax,&rmsmin,&rmsmax,&dB,&invert,&hanning,&chebfile,&nskipseconds,weights,&nweights,&perinput,&nthreads,&polar,&dualpol);
 
   /* save the command line */
   copy_cmd_line(argc,argv,command_line);
@@ -158,17 +249,18 @@ int main(int argc, char *argv[])
   /* open output file, stdout default */
   open_file(outfile,&fpoutput);
 
-  /* open file input */
-  open_flags = O_RDONLY;
-  if((fdinput1 = open(infile1, open_flags)) < 0 )
-    {
-      perror("open input file");
-      exit(1);
-    }
-  if((fdinput2 = open(infile2, open_flags)) < 0 )
+  /* open file inputs, stdin default */
+  for (k = 0; k < ninputs; k++)
     {
-      perror("open input file");
-      exit(1);
+      inputs[k].name   = infiles[k];
+      inputs[k].weight = nweights ? weights[polar ? k/2 : k] : 1;
+      if (dualpol && k % 2)
+	continue;		/* lcp of the file opened for rcp */
+      if((inputs[k].input = stream_open(infiles[k], BATCH_BYTES)) == NULL)
+	{
+	  perror("open input file");
+	  exit(1);
+	}
     }
 
   /* read Cheb coefficients, if requested */
@@ -191,11 +283,24 @@ int main(int argc, char *argv[])
     case  32: smpwd = 0.5; break; 
     default: fprintf(stderr,"Invalid mode\n"); exit(1);
     }
+  if (mode == -1)
+    {
+      fprintf(stderr,"Mode not implemented yet\n"); 
+      exit(-1);
+    }
 
   /* compute transform parameters */
   fftlen = (int) rint(fsamp / freqres * 1e6);
   bufsize = fftlen * 4 / smpwd; 
   fftlen = fftlen / downsample;
+  batch = BATCH_BYTES / bufsize;
+  if (batch < 1) batch = 1;
+  if (batch > sum) batch = sum;
+  nunits = polar ? ninputs / 2 : ninputs;
+  nspec = polar ? 4 : 1;
+  if (nthreads == 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > nunits) nthreads = nunits;
+  if (nthreads < 1) nthreads = 1;
 
   /* describe what we are doing */
   fprintf(stderr,"\n%s\n\n",command_line);
@@ -209,6 +314,14 @@ int main(int argc, char *argv[])
   fprintf(stderr,"Number of transforms to add    : %qd\n",sum);
   fprintf(stderr,"Data required for one sum      : %qd bytes\n",sum * bufsize);
   fprintf(stderr,"Integration time for one sum   : %e s\n",sum / freqres);
+  fprintf(stderr,"Inputs                         : %d, %s\n",ninputs,
+	  perinput ? "written separately" : nweights ? "weighted sum" : "summed");
+  if (polar)
+    fprintf(stderr,"Polarization of input pairs    : %s\n",
+	    polar == POL_STOKES ? "Stokes I, Q, U, V" : "rr, ll, Re(r l*), Im(r l*)");
+  if (dualpol)
+    fprintf(stderr,"Input files                    : %d, rcp and lcp of each\n",ninputs/2);
+  fprintf(stderr,"Threads                        : %d\n",nthreads);
   
   nskipbytes = (int) rint(fsamp * 1e6 * nskipseconds * 4.0 / smpwd);
   if (nskipseconds != 0)
@@ -223,16 +336,20 @@ int main(int argc, char *argv[])
     
   /* skip unwanted bytes */
   /* fsamp samples per second during nskipseconds, and 4/smpwd bytes per complex sample */
-  if (nskipbytes != lseek(fdinput1, nskipbytes, SEEK_SET))
-    {
-      fprintf(stderr,"Read error while skipping %ld bytes.  Check file size.\n",nskipbytes);
-      exit(1);
-    }
-  if (nskipbytes != lseek(fdinput2, nskipbytes, SEEK_SET))
-    {
-      fprintf(stderr,"Read error while skipping %ld bytes.  Check file size.\n",nskipbytes);
-      exit(1);
-    }
+  for (k = 0; k < ninputs; k++)
+    if (inputs[k].input && nskipbytes != stream_skip(inputs[k].input, nskipbytes))
+      {
+	fprintf(stderr,"Read error while skipping %ld bytes.  Check file size.\n",nskipbytes);
+	exit(1);
+      }
+
+  /* read every file ahead in its own thread, in large sequential chunks */
+  for (k = 0; k < ninputs; k++)
+    if (inputs[k].input && stream_readahead(inputs[k].input, 0) < 0)
+      {
+	fprintf(stderr,"Malloc error\n"); 
+	exit(1);
+      }
 
   /* verify that scaling request is sensible */
   if (rmsmin != 0 || rmsmax != 0)
@@ -244,198 +361,173 @@ int main(int argc, char *argv[])
 	}
     }
 
-  /* allocate storage */
+  /* allocate storage, and compute a fft plan for each input */
   nsamples = bufsize * smpwd / 4;
-  buffer1    = (char *)  malloc(bufsize);
-  buffer2    = (char *)  malloc(bufsize);
-  fftinbuf1  = (float *) malloc(2 * fftlen * sizeof(float));
-  fftinbuf2  = (float *) malloc(2 * fftlen * sizeof(float));
-  fftoutbuf1 = (float *) malloc(2 * fftlen * sizeof(float));
-  fftoutbuf2 = (float *) malloc(2 * fftlen * sizeof(float));
-  total1 = (float *) malloc(fftlen * sizeof(float));
-  total2 = (float *) malloc(fftlen * sizeof(float));
-  total = (float *) malloc(fftlen * sizeof(float));
-  rcp   = (char *)  malloc(2 * nsamples * sizeof(char));
-  lcp   = (char *)  malloc(2 * nsamples * sizeof(char));
-  if (!buffer2 || !fftinbuf2 || !fftoutbuf2 || !total || !rcp || !lcp)
+  total = (float *) malloc(nspec * fftlen * sizeof(float));
+  if (!total)
     {
       fprintf(stderr,"Malloc error\n"); 
       exit(1);
     }
-
-  /* compute fft plan */
-  p1 = fftwf_plan_dft_1d(fftlen, (fftwf_complex *)fftinbuf1, (fftwf_complex *)fftoutbuf1, FFTW_FORWARD, FFTW_ESTIMATE);
-  p2 = fftwf_plan_dft_1d(fftlen, (fftwf_complex *)fftinbuf2, (fftwf_complex *)fftoutbuf2, FFTW_FORWARD, FFTW_ESTIMATE);
-
-  /* label used if time series is requested */
- loop:
-
-  /* sum transforms */
-  zerofill(total1, fftlen);
-  zerofill(total2, fftlen);
-  zerofill(total, fftlen);
-  for (i = 0; i < sum; i++)
-    {
-      /* initialize fft array to zero */
-      zerofill(fftinbuf1, 2 * fftlen);
-      zerofill(fftinbuf2, 2 * fftlen);
-      
-      /* read one data buffer       */
-      if (bufsize != read(fdinput1, buffer1, bufsize))
+  for (k = 0; k < ninputs; k++)
+    {
+      in = &inputs[k];
+      if (in->input)
+	in->buffer  = (char *)  malloc(batch * bufsize);
+      else
+	in->buffer  = inputs[k-1].buffer;
+      in->unpacked  = (char *)  malloc(2 * nsamples * sizeof(char));
+      in->fftinbuf  = (float *) malloc(2 * fftlen * sizeof(float));
+      in->fftoutbuf = (float *) malloc(2 * fftlen * sizeof(float));
+      in->total     = (float *) malloc(fftlen * sizeof(float));
+      in->master    = (double *) malloc(fftlen * sizeof(double));
+      if (!in->buffer || !in->unpacked || !in->fftinbuf || !in->fftoutbuf || !in->total || !in->master)
 	{
-	  fprintf(stderr,"Read error or EOF.\n");
-	  if (timeseries) fprintf(stderr,"Wrote %d transforms\n",counter);
+	  fprintf(stderr,"Malloc error\n"); 
 	  exit(1);
 	}
-      if (bufsize != read(fdinput2, buffer2, bufsize))
+      in->plan = fftwf_plan_dft_1d(fftlen, (fftwf_complex *)in->fftinbuf, (fftwf_complex *)in->fftoutbuf, FFTW_FORWARD, FFTW_ESTIMATE);
+      if (polar && k % 2 == 0)
 	{
-	  fprintf(stderr,"Read error or EOF.\n");
-	  if (timeseries) fprintf(stderr,"Wrote %d transforms\n",counter);
-	  exit(1);
+	  in->cross   = (float *)  malloc(2 * fftlen * sizeof(float));
+	  in->xmaster = (double *) malloc(2 * fftlen * sizeof(double));
+	  in->pol     = (float *)  malloc(4 * fftlen * sizeof(float));
+	  if (!in->cross || !in->xmaster || !in->pol)
+	    {
+	      fprintf(stderr,"Malloc error\n"); 
+	      exit(1);
+	    }
 	}
+    }
+  /* threads transforming the batches, which main joins as thread 0 */
+  for (k = 0; k < nthreads; k++)
+    tnum[k] = k;
+  for (k = 1; k < nthreads; k++)
+    pthread_create(&tid[k], NULL, batch_worker, (void *) &tnum[k]);
+  nout = perinput ? nunits * nspec : nspec;
+  for (o = 0; o < nout; o++)
+    if (!perinput)
+      outspec[o] = total + o * fftlen;
+    else if (polar)
+      outspec[o] = inputs[2 * (o / 4)].pol + (o % 4) * fftlen;
+    else
+      outspec[o] = inputs[o].total;
+
+  /* label used if time series is requested */
+ loop:
 
-      /* unpack */
-      switch (mode)
+  /* sum transforms; blocks of transforms are summed in the total */
+  /* of each input and folded into its master */
+  for (k = 0; k < ninputs; k++)
+    {
+      zerofill(inputs[k].total, fftlen);
+      memset(inputs[k].master, 0, fftlen * sizeof(double));
+      inputs[k].count = 0;
+      if (inputs[k].cross)
 	{
-	case 1:
-	  unpack_pfs_2c2b(buffer1, rcp, bufsize);
-	  unpack_pfs_2c2b(buffer2, lcp, bufsize); 
-	  break;
-	case 2: 
-	  unpack_pfs_2c4b(buffer1, rcp, bufsize);
-	  unpack_pfs_2c4b(buffer2, lcp, bufsize);
-	  break;
-	case 3: 
-	  unpack_pfs_2c8b(buffer1, rcp, bufsize);
-	  unpack_pfs_2c8b(buffer2, lcp, bufsize);
-	  break;
-	case 5:
-	  unpack_pfs_4c2b_rcp (buffer1, rcp, bufsize);
-	  unpack_pfs_4c2b_lcp (buffer2, lcp, bufsize);
-	  break;
-	case 6: 
-	  unpack_pfs_4c4b_rcp (buffer1, rcp, bufsize);
-	  unpack_pfs_4c4b_lcp (buffer2, lcp, bufsize);
-	  break;
-     	case 8: 
-	  memcpy (rcp, buffer1, bufsize);
-	  memcpy (lcp, buffer2, bufsize);
-	  break;
-	case 16: 
-	  for (i = 0, j = 0; i < bufsize; i+=sizeof(short), j++)
-	    {
-	      memcpy(&x,&buffer1[i],sizeof(short));
-	      fftinbuf1[j] = (float) x;
-	      memcpy(&x,&buffer2[i],sizeof(short));
-	      fftinbuf2[j] = (float) x;
-	    }
-	  break;
-     	case 32: 
-	  memcpy(fftinbuf1,buffer1,bufsize);
-	  memcpy(fftinbuf2,buffer2,bufsize);
-	  break;
-	default: 
-	  fprintf(stderr,"Mode not implemented yet\n"); 
-	  exit(-1);
+	  zerofill(inputs[k].cross, 2 * fftlen);
+	  memset(inputs[k].xmaster, 0, 2 * fftlen * sizeof(double));
 	}
+    }
+  for (done = 0; done < sum; done += nbatch)
+    {
+      nbatch = (sum - done < batch) ? sum - done : batch;
 
-      /* downsample */
-      if (mode != 16 && mode != 32)
-	for (k = 0, l = 0; k < 2*fftlen; k += 2, l += 2*downsample)
+      /* read one batch of every input file, one after the other */
+      for (k = 0; k < ninputs; k++)
+	if (inputs[k].input && nbatch * bufsize != stream_read(inputs[k].input, inputs[k].buffer, nbatch * bufsize))
 	  {
-	    for (j = 0; j < 2*downsample; j+=2)
-	      {
-		fftinbuf1[k]   += (float) rcp[l+j];
-		fftinbuf1[k+1] += (float) rcp[l+j+1];
-		fftinbuf2[k]   += (float) lcp[l+j];
-		fftinbuf2[k+1] += (float) lcp[l+j+1];
-	      }
+	    fprintf(stderr,"Read error or EOF.\n");
+	    if (timeseries) fprintf(stderr,"Wrote %d transforms\n",counter);
+	    exit(1);
 	  }
 
-      /* transform, swap, and compute power */
-      if (invert) swap_iandq(fftinbuf1,fftlen);
-      if (invert) swap_iandq(fftinbuf2,fftlen); 
-      if (hanning) vector_window(fftinbuf1,fftlen);
-      if (hanning) vector_window(fftinbuf2,fftlen);
-      fftwf_execute(p1); 
-      fftwf_execute(p2); 
-      if (swap) swap_freq(fftoutbuf1,fftlen);
-      if (swap) swap_freq(fftoutbuf2,fftlen); 
-      vector_power(fftoutbuf1,fftlen);
-      vector_power(fftoutbuf2,fftlen);
-      
-      /* sum transforms */
-      for (j = 0; j < fftlen; j++)
-	{
-	  total1[j] += fftoutbuf1[j];
-	  total2[j] += fftoutbuf2[j];
-	}
+      /* transform the batches, spreading the inputs over the threads */
+      run_batch();
     }
+
+  for (k = 0; k < ninputs; k++)
+    {
+      in = &inputs[k];
+      fold_sum(in->master, in->total, fftlen);
+      for (j = 0; j < fftlen; j++)
+	in->total[j] = in->master[j];
   
-  /* set DC to average of neighboring values  */
-  total1[fftlen/2] = (total1[fftlen/2-1]+total1[fftlen/2+1]) / 2.0;
-  total2[fftlen/2] = (total2[fftlen/2-1]+total2[fftlen/2+1]) / 2.0; 
+      /* set DC to average of neighboring values  */
+      in->total[fftlen/2] = (in->total[fftlen/2-1]+in->total[fftlen/2+1]) / 2.0;
+    }
 
-  /* sum powers */
-  for (j = 0; j < fftlen; j++)
-    total[j] = total1[j] + total2[j];
+  /* form the polarization spectra of each pair */
+  if (polar)
+    for (k = 0; k < ninputs; k += 2)
+      {
+	in = &inputs[k];
+	fold_sum(in->xmaster, in->cross, 2 * fftlen);
+	for (j = 0; j < 2 * fftlen; j++)
+	  in->cross[j] = in->xmaster[j];
+	polarization(in->total, inputs[k+1].total, in->cross, in->pol, fftlen, polar);
+      }
 
-  /* apply Chebyshev to detected power if needed */
-  if (degree) chebyshev_window(total,fftlen,chebcoeff,degree);
-  
-  /* compute rms if needed */
-  mean = 0;
-  sigma = 1;
-  if (rmsmin != 0 || rmsmax != 0)
+  /* sum (weighted) spectra, unless each input or pair is written */
+  if (!perinput)
     {
-      /* identify relevant indices for rms power computation */
-      imin = fftlen/2 + rmsmin/freqres; 
-      imax = fftlen/2 + rmsmax/freqres; 
-      mean1 = var1 = 0;
-      n1 = 0;
-      for (i = imin; i < imax; i++)
+      zerofill(total, nspec * fftlen);
+      for (k = 0; k < nunits; k++)
 	{
-	  mean1 += total[i];
-	  var1  += total[i] * total[i];
-	  n1++;
+	  in = polar ? &inputs[2 * k] : &inputs[k];
+	  unitspec = polar ? in->pol : in->total;
+	  for (j = 0; j < nspec * fftlen; j++)
+	    total[j] += in->weight * unitspec[j];
 	}
-      mean1  = mean1 / n1;
-      var1   = var1 / n1;
-      sigma1 = sqrt(var1 - mean1 * mean1);
-
-      /* now redo calculation but exclude 3-sigma outliers */
-      mean = var = 0;
-      n = 0;
-      for (i = imin; i < imax; i++)
-	{
-	  if (fabs((total[i] - mean1)/sigma1) > 3.5)
-	    continue;
-	  mean += total[i];
-	  var  += total[i] * total[i];
-	  n++;
-	}
-      mean  = mean / n;
-      var   = var / n;
-      sigma = sqrt(var - mean * mean);
-      /*
-      fprintf(stderr,"Computed mean,sigma with    %d outliers : %e +/- %e s\n",(n1-n),mean1,sigma1);
-      fprintf(stderr,"Computed mean,sigma without %d outliers : %e +/- %e s\n",(n1-n),mean,sigma);
-      */
+    }
+
+  for (o = 0; o < nout; o++)
+    {
+      spectrum = outspec[o];
+
+      /* apply Chebyshev to detected power if needed */
+      if (degree) chebyshev_window(spectrum,fftlen,chebcoeff,degree);
+  
+      /* compute rms if needed */
+      mean[o] = 0;
+      sigma[o] = 1;
+      if (rmsmin != 0 || rmsmax != 0)
+	spectrum_rms(spectrum,fftlen,freqres,rmsmin,rmsmax,&mean[o],&sigma[o]);
     }
   
   /* write output */
   /* either time series */
   if (timeseries)
     {
-      for (i = 0; i < fftlen; i++) total[i] = (total[i]-mean)/sigma;
-      if (fftlen != fwrite(total,sizeof(float),fftlen,fpoutput))
-	fprintf(stderr,"Write error\n");
+      for (o = 0; o < nout; o++)
+	{
+	  spectrum = outspec[o];
+	  for (i = 0; i < fftlen; i++) spectrum[i] = (spectrum[i]-mean[o])/sigma[o];
+	  if (fftlen != fwrite(spectrum,sizeof(float),fftlen,fpoutput))
+	    fprintf(stderr,"Write error\n");
+	}
       fflush(fpoutput);
       counter++;
       goto loop;
     }
-  /* or standard output */
+  /* or standard output, one spectrum after the other if binary */
   /* or limited frequency range */
+  else if (binary)
+    for (o = 0; o < nout; o++)
+      {
+	spectrum = outspec[o];
+	for (i = 0; i < fftlen; i++)
+	  {
+	    freq = (i-fftlen/2)*freqres;
+	    if ((freqmin == 0.0 && freqmax == 0.0) || (freq >= freqmin && freq <= freqmax)) 
+	      {
+		value = (spectrum[i]-mean[o])/sigma[o];
+		if (dB) value = 10*log10(value);
+		fwrite(&value,sizeof(float),1,fpoutput);
+	      }
+	  }
+      }
+  /* one column per spectrum if text */
   else
     for (i = 0; i < fftlen; i++)
       {
@@ -443,26 +535,315 @@ int main(int argc, char *argv[])
     
 	  if ((freqmin == 0.0 && freqmax == 0.0) || (freq >= freqmin && freq <= freqmax)) 
 	  {
-	    value = (total[i]-mean)/sigma;
-	    if (dB) value = 10*log10(value);
-
-	    if (binary)
-	      fwrite(&value,sizeof(float),1,fpoutput);
-	    else
-	      fprintf(fpoutput,"% .3f % .3e\n",freq,value);  
+	    fprintf(fpoutput,"% .3f",freq);
+	    for (o = 0; o < nout; o++)
+	      {
+		spectrum = outspec[o];
+		value = (spectrum[i]-mean[o])/sigma[o];
+		if (dB) value = 10*log10(value);
+		fprintf(fpoutput," % .3e",value);
+	      }
+	    fprintf(fpoutput,"\n");
 	  }
       }
 
-  fftwf_destroy_plan(p1);
-  fftwf_destroy_plan(p2);
-  free(fftinbuf1);
-  free(fftoutbuf1);
-  free(fftinbuf2);
-  free(fftoutbuf2);
+  pthread_mutex_lock(&worklock);
+  workend = 1;
+  pthread_cond_broadcast(&workcond);
+  pthread_mutex_unlock(&worklock);
+  for (k = 1; k < nthreads; k++)
+    pthread_join(tid[k], NULL);
+
+  for (k = 0; k < ninputs; k++)
+    {
+      fftwf_destroy_plan(inputs[k].plan);
+      free(inputs[k].fftinbuf);
+      free(inputs[k].fftoutbuf);
+    }
   
   return 0;
 }
 
+/******************************************************************************/
+/*	run_batch							      */
+/******************************************************************************/
+void run_batch(void)
+{
+  /* hands the batch to the threads, transforms the inputs of thread 0
+     itself, and waits for the others
+  */
+  pthread_mutex_lock(&worklock);
+  nbusy = nthreads - 1;
+  njobs++;
+  pthread_cond_broadcast(&workcond);
+  pthread_mutex_unlock(&worklock);
+
+  transform_inputs(&tnum[0]);
+
+  pthread_mutex_lock(&worklock);
+  while (nbusy > 0)
+    pthread_cond_wait(&donecond, &worklock);
+  pthread_mutex_unlock(&worklock);
+
+  return;
+}
+
+/******************************************************************************/
+/*	batch_worker							      */
+/******************************************************************************/
+void *batch_worker(void *arg)
+{
+  /* thread *arg: transforms its inputs of every batch until the last */
+  long long n;
+
+  for (n = 1; ; n++)
+    {
+      pthread_mutex_lock(&worklock);
+      while (njobs < n && !workend)
+	pthread_cond_wait(&workcond, &worklock);
+      if (njobs < n)
+	{
+	  pthread_mutex_unlock(&worklock);
+	  break;
+	}
+      pthread_mutex_unlock(&worklock);
+
+      transform_inputs(arg);
+
+      pthread_mutex_lock(&worklock);
+      if (--nbusy == 0)
+	pthread_cond_signal(&donecond);
+      pthread_mutex_unlock(&worklock);
+    }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/*	transform_inputs						      */
+/******************************************************************************/
+void *transform_inputs(void *arg)
+{
+  /* Transforms the nbatch transforms read from every nthreads-th input,
+     or pair of inputs with -Q, starting with number *arg, and adds their
+     powers, and the cross products of pairs, to the sums of the inputs
+  */
+  struct FFTINPUT *in;
+  struct FFTINPUT *in2;	/* second input of a pair */
+  long long b;
+  int j,k,u;
+
+  for (u = *(int *) arg; u < nunits; u += nthreads)
+    {
+      k   = polar ? 2 * u : u;
+      in  = &inputs[k];
+      in2 = &inputs[k + 1];
+      for (b = 0; b < nbatch; b++)
+	{
+	  transform_one(in, k, in->buffer + b * bufsize);
+	  if (polar)
+	    {
+	      transform_one(in2, k + 1, in2->buffer + b * bufsize);
+	      cross_power(in->fftoutbuf, in2->fftoutbuf, in->cross, fftlen);
+	      vector_power(in2->fftoutbuf,fftlen);
+	      for (j = 0; j < fftlen; j++)
+		in2->total[j] += in2->fftoutbuf[j];
+	    }
+	  vector_power(in->fftoutbuf,fftlen);
+
+	  /* sum transforms */
+	  for (j = 0; j < fftlen; j++)
+	    in->total[j] += in->fftoutbuf[j];
+	  if (++in->count % ACCUM_BLOCK == 0)
+	    {
+	      fold_sum(in->master, in->total, fftlen);
+	      if (polar)
+		{
+		  fold_sum(in2->master, in2->total, fftlen);
+		  fold_sum(in->xmaster, in->cross, 2 * fftlen);
+		}
+	    }
+	}
+    }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/*	transform_one							      */
+/******************************************************************************/
+void transform_one(struct FFTINPUT *in, int k, char *buffer)
+{
+  /* Unpacks and downsamples the packed data of one transform of input
+     number k, and leaves its complex transform in the fft output buffer.
+     Modes 5 and 6 take the rcp channel from the first, third, ... inputs
+     and the lcp channel from the second, fourth, ...
+  */
+  int j,l,m;
+
+  /* initialize fft array to zero */
+  zerofill(in->fftinbuf, 2 * fftlen);
+
+  /* unpack */
+  switch (mode)
+    {
+    case 1:
+      unpack_pfs_2c2b(buffer, in->unpacked, bufsize);
+      break;
+    case 2: 
+      unpack_pfs_2c4b(buffer, in->unpacked, bufsize);
+      break;
+    case 3: 
+      unpack_pfs_2c8b(buffer, in->unpacked, bufsize);
+      break;
+    case 5:
+      if (k % 2 == 0)
+	unpack_pfs_4c2b_rcp(buffer, in->unpacked, bufsize);
+      else
+	unpack_pfs_4c2b_lcp(buffer, in->unpacked, bufsize);
+      break;
+    case 6: 
+      if (k % 2 == 0)
+	unpack_pfs_4c4b_rcp(buffer, in->unpacked, bufsize);
+      else
+	unpack_pfs_4c4b_lcp(buffer, in->unpacked, bufsize);
+      break;
+    case 8: 
+      memcpy(in->unpacked, buffer, bufsize);
+      break;
+    case 16: 
+    case 32: 
+      /* converted while downsampling */
+      break;
+    }
+
+  /* downsample */
+  if (mode == 16)
+    downsample_int16((short *) buffer, in->fftinbuf, fftlen, downsample);
+  else if (mode == 32)
+    downsample_float((float *) buffer, in->fftinbuf, fftlen, downsample);
+  else
+    for (j = 0, l = 0; j < 2*fftlen; j += 2, l += 2*downsample)
+      for (m = 0; m < 2*downsample; m += 2)
+	{
+	  in->fftinbuf[j]   += (float) in->unpacked[l+m];
+	  in->fftinbuf[j+1] += (float) in->unpacked[l+m+1];
+	}
+
+  /* transform and swap */
+  if (invert) swap_iandq(in->fftinbuf,fftlen);
+  if (hanning) vector_window(in->fftinbuf,fftlen);
+  fftwf_execute(in->plan); 
+  if (swap) swap_freq(in->fftoutbuf,fftlen);
+
+  return;
+}
+
+/******************************************************************************/
+/*	cross_power							      */
+/******************************************************************************/
+void cross_power(float *r, float *l, float *cross, int len)
+{
+  /* adds the cross products r l* of the complex arrays r and l of len
+     complex samples to the complex array cross
+  */
+  int i,j;
+
+  for (i=0, j=1; i<2*len; i+=2, j+=2)
+    {
+      cross[i] += r[i]*l[i] + r[j]*l[j];
+      cross[j] += r[j]*l[i] - r[i]*l[j];
+    }
+
+  return;
+}
+
+/******************************************************************************/
+/*	polarization							      */
+/******************************************************************************/
+void polarization(float *rr, float *ll, float *cross, float *pol, int len, int polar)
+{
+  /* Fills the four consecutive spectra of pol with the Stokes parameters
+	I = rr + ll, Q = 2 Re(r l*), U = -2 Im(r l*), V = rr - ll
+     or the products rr, ll, Re(r l*), Im(r l*), from the powers rr and
+     ll and the complex cross products r l*, of len channels; the DC
+     channel of the cross products is set to the average of its neighbors
+  */
+  float re, im;
+  int   i;
+  int   dc = 2*(len/2);		/* float offset of the DC channel */
+
+  cross[dc]   = (cross[dc-2] + cross[dc+2]) / 2.0;
+  cross[dc+1] = (cross[dc-1] + cross[dc+3]) / 2.0;
+
+  for (i=0; i<len; i++)
+    {
+      re = cross[2*i];
+      im = cross[2*i+1];
+      if (polar == POL_STOKES)
+	{
+	  pol[i]         = rr[i] + ll[i];
+	  pol[i + len]   = 2 * re;
+	  pol[i + 2*len] = -2 * im;
+	  pol[i + 3*len] = rr[i] - ll[i];
+	}
+      else
+	{
+	  pol[i]         = rr[i];
+	  pol[i + len]   = ll[i];
+	  pol[i + 2*len] = re;
+	  pol[i + 3*len] = im;
+	}
+    }
+
+  return;
+}
+
+/******************************************************************************/
+/*	spectrum_rms							      */
+/******************************************************************************/
+void spectrum_rms(float *data, int len, double freqres, float rmsmin, float rmsmax, double *mean, double *sigma)
+{
+  /* Computes the mean and standard deviation of the power between rmsmin
+     and rmsmax (Hz), leaving out values deviating by more than 3.5 sigmas
+  */
+  double mean1,var,var1,sigma1;
+  int    imin,imax;		/* indices for rms calculation */
+  int    i,n,n1;
+
+  /* identify relevant indices for rms power computation */
+  imin = len/2 + rmsmin/freqres; 
+  imax = len/2 + rmsmax/freqres; 
+  mean1 = var1 = 0;
+  n1 = 0;
+  for (i = imin; i < imax; i++)
+    {
+      mean1 += data[i];
+      var1  += data[i] * data[i];
+      n1++;
+    }
+  mean1  = mean1 / n1;
+  var1   = var1 / n1;
+  sigma1 = sqrt(var1 - mean1 * mean1);
+
+  /* now redo calculation but exclude 3-sigma outliers */
+  *mean = var = 0;
+  n = 0;
+  for (i = imin; i < imax; i++)
+    {
+      if (fabs((data[i] - mean1)/sigma1) > 3.5)
+	continue;
+      *mean += data[i];
+      var   += data[i] * data[i];
+      n++;
+    }
+  *mean  = *mean / n;
+  var    = var / n;
+  *sigma = sqrt(var - *mean * *mean);
+
+  return;
+}
+
 /******************************************************************************/
 /*	vector_window							      */
 /******************************************************************************/
@@ -537,11 +918,11 @@ double chebeval(double x, double c[], int degree)
 /******************************************************************************/
 /*	processargs							      */
 /******************************************************************************/
-void	processargs(argc,argv,infile1,infile2,outfile,mode,fsamp,freqres,downsample,sum,binary,timeseries,chan,freqmin,freqmax,rmsmin,rmsmax,dB,invert,hanning,chebfile,nskipseconds)
+void	processargs(argc,argv,infiles,ninputs,outfile,mode,fsamp,freqres,downsample,sum,binary,timeseries,chan,freqmin,freqmax,rmsmin,rmsmax,dB,invert,hanning,chebfile,nskipseconds,weights,nweights,perinput,nthreads,polar,dualpol)
 int	argc;
 char	**argv;			 /* command line arguements */
-char	**infile1;		 /* input file name 1 */
-char	**infile2;		 /* input file name 2 */
+char	**infiles;		 /* input file names */
+int     *ninputs;		 /* number of input files */
 char	**outfile;		 /* output file name */
 int     *mode;
 double   *fsamp;
@@ -560,11 +941,17 @@ int     *invert;
 int     *hanning;
 char    **chebfile;
 float     *nskipseconds;
+float   *weights;
+int     *nweights;
+int     *perinput;
+int     *nthreads;
+int     *polar;
+int     *dualpol;
 {
   /* function to process a programs input command line.
      This is a template which has been customised for the pfs_fft program:
 	- the outfile name is set from the -o option
-	- the infile name is set from the 1st unoptioned argument
+	- the infile names are set from the unoptioned arguments
   */
 
   int getopt();		/* c lib function returns next opt*/ 
@@ -572,17 +959,17 @@ float     *nskipseconds;
   extern int optind;	/* after call, ind into argv for next*/
   extern int opterr;    /* if 0, getopt won't output err mesg*/
 
-  char *myoptions = "m:f:d:r:n:tc:o:lbx:s:iHC:S:"; /* options to search for :=> argument*/
-  char *USAGE1="pfs_fft -m mode -f sampling frequency (MHz) [-r desired frequency resolution (Hz)] [-d downsampling factor] [-n sum n transforms] [-l (dB output)] [-b (binary output)] [-t time series] [-x freqmin,freqmax (Hz)] [-s scale to sigmas using smin,smax (Hz)] [-c channel (1 or 2)] [-i swap IQ before transform (invert freq axis)] [-H apply Hanning window before transform] [-C file of Chebyshev polynomial coefficients defining window to apply after transform] [-S number of seconds to skip before applying first FFT] [-o outfile] infile1 infile2";
+  char *myoptions = "m:f:d:r:n:tc:o:lbx:s:iHC:S:w:pT:Q:D"; /* options to search for :=> argument*/
+  char *USAGE1="pfs_fft -m mode -f sampling frequency (MHz) [-r desired frequency resolution (Hz)] [-d downsampling factor] [-n sum n transforms] [-l (dB output)] [-b (binary output)] [-t time series] [-x freqmin,freqmax (Hz)] [-s scale to sigmas using smin,smax (Hz)] [-c channel (1 or 2)] [-i swap IQ before transform (invert freq axis)] [-H apply Hanning window before transform] [-C file of Chebyshev polynomial coefficients defining window to apply after transform] [-S number of seconds to skip before applying first FFT] [-w w1,w2,... weights of inputs] [-p (power of each input)] [-Q stokes|products (polarization of input pairs)] [-D (rcp and lcp of each file, modes 5 and 6)] [-T threads] [-o outfile] infile1 infile2 ... (one may be - for stdin)";
   char *USAGE2="Valid modes are\n\t 0: 2c1b (N/A)\n\t 1: 2c2b\n\t 2: 2c4b\n\t 3: 2c8b\n\t 4: 4c1b (N/A)\n\t 5: 4c2b\n\t 6: 4c4b\n\t 7: 4c8b (N/A)\n\t 8: signed bytes\n\t16: signed 16bit\n\t32: 32bit floats\n";
   int  c;			 /* option letter returned by getopt  */
   int  arg_count = 1;		 /* optioned argument count */
+  char *weight;			 /* one of the -w weights */
+  int  k;
 
   /* default parameters */
   opterr = 0;			 /* turn off there message */
-  *infile1  = "-";		 /* initialise to stdin, stdout */
-  *infile2  = "-";		 /* initialise to stdin, stdout */
-  *outfile = "-";
+  *outfile = "-";		 /* initialise to stdout */
 
   *mode  = 0;                /* default value */
   *fsamp = 0;
@@ -601,6 +988,11 @@ float     *nskipseconds;
   *freqmax = 0;		/* not set value */
   *rmsmin  = 0;		/* not set value */
   *rmsmax  = 0;		/* not set value */
+  *nweights = 0;	/* default is a plain sum */
+  *perinput = 0;
+  *nthreads = 0;	/* default is one thread per processor */
+  *polar = 0;		/* default is powers only */
+  *dualpol = 0;		/* default is one channel per file */
 
   /* loop over all the options in list */
   while ((c = getopt(argc,argv,myoptions)) != -1)
@@ -677,6 +1069,42 @@ float     *nskipseconds;
 	arg_count += 1;
 	break;
 
+      case 'w':
+	for (weight = strtok(optarg, ","); weight; weight = strtok(NULL, ","))
+	  {
+	    if (*nweights == MAXINPUTS)
+	      goto errout;
+	    if (sscanf(weight,"%f",&weights[(*nweights)++]) != 1)
+	      goto errout;
+	  }
+	arg_count += 2;
+	break;
+
+      case 'p':
+	*perinput = 1;
+	arg_count += 1;
+	break;
+
+      case 'T':
+	sscanf(optarg,"%d",nthreads);
+	arg_count += 2;
+	break;
+
+      case 'Q':
+	if (strcmp(optarg,"stokes") == 0)
+	  *polar = POL_STOKES;
+	else if (strcmp(optarg,"products") == 0)
+	  *polar = POL_PRODUCTS;
+	else
+	  goto errout;
+	arg_count += 2;
+	break;
+
+      case 'D':
+	*dualpol = 1;
+	arg_count += 1;
+	break;
+
       case 'x':
 	if ( no_comma_in_string(optarg) )
 	  {
@@ -711,13 +1139,64 @@ float     *nskipseconds;
       }
   }
   
-  if (arg_count < argc)		 /* 1st non-optioned param is infile1 */
-    *infile1 = argv[arg_count];
-  arg_count += 1;
+  /* non-optioned params are the input files, stdin for missing ones */
+  for (*ninputs = 0; arg_count < argc && *ninputs < MAXINPUTS; arg_count++)
+    infiles[(*ninputs)++] = argv[arg_count];
+  if (arg_count < argc)
+    {
+      fprintf(stderr,"At most %d input files\n",MAXINPUTS);
+      goto errout;
+    }
+  while (*ninputs < (*dualpol ? 1 : 2))
+    infiles[(*ninputs)++] = "-";
 
-  if (arg_count < argc)		 /* 2nd non-optioned param is infile2 */
-    *infile2 = argv[arg_count];
-  arg_count += 1;
+  /* only one input can come from stdin */
+  for (k = 0, c = 0; k < *ninputs; k++)
+    if (strcmp(infiles[k],"-") == 0) c++;
+  if (c > 1)
+    {
+      fprintf(stderr,"Must specify at most one input from stdin\n");
+      goto errout;
+    }
+
+  /* with -D each file is read once, for an rcp and an lcp input */
+  if (*dualpol)
+    {
+      if (*mode != 5 && *mode != 6)
+	{
+	  fprintf(stderr,"Can only have -D in modes 5 and 6\n");
+	  goto errout;
+	}
+      if (2 * *ninputs > MAXINPUTS)
+	{
+	  fprintf(stderr,"At most %d input files with -D\n",MAXINPUTS/2);
+	  goto errout;
+	}
+      for (k = *ninputs - 1; k >= 0; k--)
+	infiles[2*k] = infiles[2*k+1] = infiles[k];
+      *ninputs *= 2;
+    }
+  if (*polar && *ninputs % 2)
+    {
+      fprintf(stderr,"Must specify pairs of inputs with -Q\n");
+      goto errout;
+    }
+  if (*polar && *dB)
+    {
+      fprintf(stderr,"Cannot have -Q and -l simultaneously\n");
+      goto errout;
+    }
+  if (*nweights && *nweights != (*polar ? *ninputs / 2 : *ninputs))
+    {
+      fprintf(stderr,"Must specify one -w weight per input, or pair of inputs with -Q\n");
+      goto errout;
+    }
+  if (*nweights && *perinput)
+    {
+      fprintf(stderr,"Cannot have -w and -p simultaneously\n");
+      goto errout;
+    }
+  if (*nthreads < 0) goto errout;
   
   /* must specify a valid mode */
   if (*mode == 0)
@@ -744,11 +1223,6 @@ float     *nskipseconds;
       fprintf(stderr,"Cannot have -t and -x simultaneously yet\n");
       goto errout;
     }
-  if (*downsample > 1 && (*mode == 16 || *mode == 32)) 
-    {
-      fprintf(stderr,"Cannot have -d with modes 16 or 32 yet\n");
-      exit (1);
-    }
 
   return;
 
@@ -831,6 +1305,70 @@ char	command_line[];		/* command line parameters in single string */
   return;
 }	
 
+/******************************************************************************/
+/*	downsample_int16						      */
+/******************************************************************************/
+void downsample_int16(short *in, float *out, int len, int downsample)
+{
+  /* Converts len * downsample complex 16 bit samples to floats and sums
+     each group of downsample consecutive samples coherently into the len
+     complex samples of out.
+  */
+  float re, im;
+  int   k, j;
+
+  if (downsample == 1)
+    {
+      for (k = 0; k < 2*len; k++)
+	out[k] = (float) in[k];
+      return;
+    }
+
+  for (k = 0; k < len; k++, in += 2*downsample)
+    {
+      re = im = 0;
+      for (j = 0; j < 2*downsample; j += 2)
+	{
+	  re += (float) in[j];
+	  im += (float) in[j+1];
+	}
+      out[2*k]   = re;
+      out[2*k+1] = im;
+    }
+  return;
+}
+
+/******************************************************************************/
+/*	downsample_float						      */
+/******************************************************************************/
+void downsample_float(float *in, float *out, int len, int downsample)
+{
+  /* Sums each group of downsample consecutive complex float samples
+     coherently into the len complex samples of out.
+  */
+  float re, im;
+  int   k, j;
+
+  if (downsample == 1)
+    {
+      memcpy(out, in, 2 * len * sizeof(float));
+      return;
+    }
+
+  for (k = 0; k < len; k++, in += 2*downsample)
+    {
+      re = im = 0;
+      for (j = 0; j < 2*downsample; j += 2)
+	{
+	  re += in[j];
+	  im += in[j+1];
+	}
+      out[2*k]   = re;
+      out[2*k+1] = im;
+    }
+  return;
+}
+
 /******************************************************************************/
 /*	vector_power							      */
 /******************************************************************************/
@@ -906,6 +1444,27 @@ void zerofill(float *data, int len)
   return;
 }
 
+/******************************************************************************/
+/*	fold_sum							      */
+/******************************************************************************/
+void fold_sum(double *sum, float *block, int len)
+{
+  /* adds the float block sums to the double precision sums and zeroes
+     the block, so that long integrations do not lose the contributions
+     of individual transforms to rounding
+  */
+
+  int i;
+
+  for (i=0; i<len; i++)
+    {
+      sum[i]  += block[i];
+      block[i] = 0.0;
+    }
+
+  return;
+}
+
 /******************************************************************************/
 /*	no_comma_in_string						      */
 /******************************************************************************/
@@ -15,12 +15,17 @@
 *  for phase rotation, also specify
 *                  [-f sampling frequency (MHz)]
 *                  [-x desired frequency offset (Hz)]
+*               or [-X file of signal frequency versus time to compensate]
 *
 *  input:
 *       the input parameters are typed in as command line arguments
 *	the -m argument specifies the data acquisition mode
 *       the -c argument specifies which channel (1 or 2) to process
 *       the -a option allows text output instead of binary output
+*       the -X argument names a polynomial or tabulated model of the signal
+*               frequency (Hz) versus time from the start of the file (s),
+*               such as a Doppler prediction; the signal is mixed to zero
+*               frequency (see doppler.c)
 *
 *  output:
 *	the -o option identifies the output file, stdout is default
@@ -101,6 +106,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include "unpack.h"
+#include "doppler.h"
 
 /* revision control variable */
 static char const rcsid[] = 
@@ -111,6 +117,7 @@ int	fdinput;		/* file descriptor for input file */
 
 char   *outfile;		/* output file name */
 char   *infile;		        /* input file name */
+char   *modelfile;	        /* file of signal frequency versus time */
 
 char	command_line[200];	/* command line assembled by processargs */
 
@@ -130,6 +137,7 @@ int main(int argc, char *argv[])
   float *outbuf;	/* float buffer for unpacked data */
   double fsamp;		/* sampling frequency, MHz */
   double foff;		/* frequency offset, Hz */
+  struct DOPPLER *dop = NULL; /* frequency model to compensate, if any */
   double timeint;	/* sampling interval */ 
   double time;		/* time */ 
   int mode;
@@ -145,7 +153,7 @@ int main(int argc, char *argv[])
   format = (char *) malloc(100);
 
   /* get the command line arguments and open the files */
-  processargs(argc,argv,&infile,&outfile,&mode,&chan,&ascii,&mdetect,&pdetect,&fsamp,&foff);
+  processargs(argc,argv,&infile,&outfile,&mode,&chan,&ascii,&mdetect,&pdetect,&fsamp,&foff,&modelfile);
 
   /* save the command line */
   copy_cmd_line(argc,argv,command_line);
@@ -202,6 +210,10 @@ int main(int argc, char *argv[])
   time = 0;
   timeint = 1.0 / (fsamp * 1e6);
 
+  /* read frequency model */
+  if (modelfile[0] != '-' && (dop = doppler_open(modelfile, fsamp, 0.0)) == NULL)
+    exit(1);
+
   /* infinite loop */
   while (1)
     {
@@ -266,6 +278,10 @@ int main(int argc, char *argv[])
 	  time += timeint * nsamples;
 	}
 
+      /* optionally compensate a time-varying frequency */
+      if (dop)
+	doppler_mix(dop, outbuf, nsamples);
+
       /* optionally compute magnitude */
       if (mdetect && !pdetect)
 	{
@@ -350,7 +366,7 @@ void apply_linear_phase(float *data, double freq, double time, double timeint, i
 /******************************************************************************/
 /*	processargs							      */
 /******************************************************************************/
-void	processargs(argc,argv,infile,outfile,mode,chan,ascii,mdetect,pdetect,fsamp,foff)
+void	processargs(argc,argv,infile,outfile,mode,chan,ascii,mdetect,pdetect,fsamp,foff,modelfile)
 int	argc;
 char	**argv;			 /* command line arguements */
 char	**infile;		 /* input file name */
@@ -362,6 +378,7 @@ int     *mdetect;
 int     *pdetect;
 double   *fsamp;
 double   *foff;
+char    **modelfile;
 {
   /* function to process a programs input command line.
      This is a template which has been customised for the pfs_unpack program:
@@ -374,9 +391,9 @@ double   *foff;
   extern int optind;	/* after call, ind into argv for next*/
   extern int opterr;    /* if 0, getopt won't output err mesg*/
 
-  char *myoptions = "m:c:o:adpf:x:"; 	 /* options to search for :=> argument*/
+  char *myoptions = "m:c:o:adpf:x:X:"; 	 /* options to search for :=> argument*/
   char *USAGE1="pfs_unpack -m mode [-c channel (1 or 2)] [-d (detect and output magnitude)] [-p (detect and output power)] [-o outfile (- for stdout)] [infile (- for stdin)] ";
-  char *USAGE2="For phase rotation, also specify [-f sampling frequency (MHz)] [-x desired frequency offset (Hz)] ";
+  char *USAGE2="For phase rotation, also specify [-f sampling frequency (MHz)] [-x desired frequency offset (Hz)] or [-X file of frequency versus time to compensate] ";
   char *USAGE3="Valid modes are\n\t 0: 2c1b (N/A)\n\t 1: 2c2b\n\t 2: 2c4b\n\t 3: 2c8b\n\t 4: 4c1b (N/A)\n\t 5: 4c2b\n\t 6: 4c4b\n\t 7: 4c8b (N/A)\n\t 8: signed bytes\n\t16: signed 16bit\n\t32: 32bit floats\n";
 
   int  c;			 /* option letter returned by getopt  */
@@ -394,6 +411,7 @@ double   *foff;
   *pdetect = 0;
   *foff  = 0;
   *fsamp = 0;
+  *modelfile = "-";
 
   /* loop over all the options in list */
   while ((c = getopt(argc,argv,myoptions)) != -1)
@@ -425,6 +443,11 @@ double   *foff;
 	arg_count += 2;
 	break;
 	
+      case 'X':
+	*modelfile = optarg;
+	arg_count += 2;
+	break;
+	
       case 'a':
 	*ascii = 1;
 	arg_count += 1;
@@ -453,7 +476,8 @@ double   *foff;
   if (*mode == 0 ) goto errout;
 
   /* must specify valid sampling frequency */
-  if (*foff != 0 && *fsamp == 0) goto errout;
+  if ((*foff != 0 || *modelfile[0] != '-') && *fsamp == 0) goto errout;
+  if (*foff != 0 && *modelfile[0] != '-') goto errout;
   
   return;
 
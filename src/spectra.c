@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "spectra.h"
+
+/* files of spectra that carry their own parameters and an index, so that */
+/* readers can map them and go straight to any spectrum                  */
+
+/******************************************************************************/
+/*	spec_create							      */
+/******************************************************************************/
+struct SPECFILE *spec_create (FILE *fp, struct SPECHEADER *h)
+{
+  /* writes the header h to the output fp, which must be at its start,
+     padded to SPEC_HDRSIZE bytes; the spectra follow with spec_write
+     returns NULL on error
+  */
+  struct SPECFILE *s;
+  char   pad[SPEC_HDRSIZE];
+
+  s = (struct SPECFILE *) calloc(1, sizeof(struct SPECFILE));
+  if (s == NULL)
+    return NULL;
+
+  s->fp  = fp;
+  s->hdr = &s->head;
+  s->head = *h;
+  strcpy(s->head.magic, "PFSSPEC");
+  s->head.size     = sizeof(struct SPECHEADER);
+  s->head.version  = SPEC_VERSION;
+  s->head.nspectra = 0;
+  s->head.index    = 0;
+
+  memset(pad, 0, sizeof(pad));
+  memcpy(pad, &s->head, sizeof(struct SPECHEADER));
+  if (fwrite(pad, 1, SPEC_HDRSIZE, fp) != SPEC_HDRSIZE)
+    {
+      fprintf(stderr,"spec_create: write error\n");
+      free(s);
+      return NULL;
+    }
+
+  /* nothing may remain buffered if the caller forks */
+  fflush(fp);
+  return s;
+}
+
+/******************************************************************************/
+/*	spec_write							      */
+/******************************************************************************/
+int spec_write (struct SPECFILE *s, float *data)
+{
+  /* appends one spectrum of nchan channels
+     returns 0, or -1 on a write error
+  */
+  if (fwrite(data, sizeof(float), s->head.nchan, s->fp) != (size_t) s->head.nchan)
+    return -1;
+  s->nspectra++;
+  return 0;
+}
+
+/******************************************************************************/
+/*	spec_extend							      */
+/******************************************************************************/
+void spec_extend (struct SPECFILE *s, long long n)
+{
+  /* accounts for n spectra that were appended to the output directly */
+  s->nspectra += n;
+  return;
+}
+
+/******************************************************************************/
+/*	spec_integration						      */
+/******************************************************************************/
+void spec_integration (struct SPECFILE *s, long long sum, double tint)
+{
+  /* replaces the number of transforms summed in each spectrum and the
+     time between spectra, once they are known, in the header that
+     spec_close completes
+  */
+  s->head.sum  = sum;
+  s->head.tint = tint;
+  return;
+}
+
+/******************************************************************************/
+/*	spec_probe							      */
+/******************************************************************************/
+int spec_probe (char *name)
+{
+  /* returns 1 if the named file starts with a spectra header */
+  char magic[8];
+  int  fd, n;
+
+  if (name[0] == '-' && name[1] == '\0')
+    return 0;
+  if ((fd = open(name, O_RDONLY)) < 0)
+    return 0;
+  n = read(fd, magic, sizeof(magic));
+  close(fd);
+  return n == sizeof(magic) && strcmp(magic, "PFSSPEC") == 0;
+}
+
+/******************************************************************************/
+/*	spec_open							      */
+/******************************************************************************/
+struct SPECFILE *spec_open (char *name)
+{
+  /* maps the named file of spectra for reading
+     returns NULL if it is not a file of spectra, and exits if it is
+     one that cannot be used
+  */
+  struct SPECFILE *s;
+  struct stat filestat;
+  char  *map;
+  int    fd;
+
+  if (!spec_probe(name) || (fd = open(name, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &filestat) < 0 || filestat.st_size < SPEC_HDRSIZE)
+    {
+      fprintf(stderr,"spec_open: %s is truncated\n", name);
+      exit(1);
+    }
+  map = mmap(NULL, filestat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    {
+      perror("spec_open: mmap");
+      exit(1);
+    }
+
+  s = (struct SPECFILE *) calloc(1, sizeof(struct SPECFILE));
+  if (s == NULL)
+    {
+      fprintf(stderr,"Malloc error\n");
+      exit(1);
+    }
+  s->map    = map;
+  s->maplen = filestat.st_size;
+  s->hdr    = (struct SPECHEADER *) map;
+
+  if (s->hdr->size != sizeof(struct SPECHEADER) || s->hdr->version != SPEC_VERSION ||
+      s->hdr->nchan < 1)
+    {
+      fprintf(stderr,"spec_open: %s has an unsupported header\n", name);
+      exit(1);
+    }
+
+  /* a file that was not closed, or was written to a pipe, has no index */
+  if (s->hdr->index && s->hdr->index + s->hdr->nspectra * sizeof(struct SPECINDEX) <= s->maplen)
+    {
+      s->index    = (struct SPECINDEX *) (map + s->hdr->index);
+      s->nspectra = s->hdr->nspectra;
+    }
+  else
+    s->nspectra = (s->maplen - SPEC_HDRSIZE) / (s->hdr->nchan * sizeof(float));
+
+  return s;
+}
+
+/******************************************************************************/
+/*	spec_data							      */
+/******************************************************************************/
+float *spec_data (struct SPECFILE *s, long long k)
+{
+  /* returns spectrum k of a mapped file, or NULL past the last one */
+  long long offset;
+
+  if (k < 0 || k >= s->nspectra)
+    return NULL;
+  if (s->index)
+    offset = s->index[k].offset;
+  else
+    offset = SPEC_HDRSIZE + k * s->hdr->nchan * sizeof(float);
+  if (offset + s->hdr->nchan * sizeof(float) > s->maplen)
+    return NULL;
+  return (float *) (s->map + offset);
+}
+
+/******************************************************************************/
+/*	spec_time							      */
+/******************************************************************************/
+double spec_time (struct SPECFILE *s, long long k)
+{
+  /* returns the time of the first transform of spectrum k, s */
+  if (s->index && k >= 0 && k < s->nspectra)
+    return s->index[k].time;
+  return s->hdr->start + k * s->hdr->tint;
+}
+
+/******************************************************************************/
+/*	spec_close							      */
+/******************************************************************************/
+void spec_close (struct SPECFILE *s)
+{
+  /* unmaps a file being read, or appends the index to a file being
+     written and completes its header; an output that cannot seek keeps
+     the initial header, and readers count its spectra from its size
+  */
+  struct SPECINDEX entry;
+  long long k;
+
+  if (s->map)
+    munmap(s->map, s->maplen);
+  else if (fseek(s->fp, 0, SEEK_CUR) == 0)
+    {
+      s->head.nspectra = s->nspectra;
+      s->head.index    = SPEC_HDRSIZE + s->nspectra * s->head.nchan * sizeof(float);
+      for (k = 0; k < s->nspectra; k++)
+	{
+	  entry.offset = SPEC_HDRSIZE + k * s->head.nchan * sizeof(float);
+	  entry.time   = s->head.start + k * s->head.tint;
+	  fwrite(&entry, sizeof(entry), 1, s->fp);
+	}
+      if (fseek(s->fp, 0, SEEK_SET) != 0 ||
+	  fwrite(&s->head, sizeof(struct SPECHEADER), 1, s->fp) != 1 ||
+	  fseek(s->fp, 0, SEEK_END) != 0)
+	fprintf(stderr,"spec_close: cannot complete header\n");
+      fflush(s->fp);
+    }
+  else
+    fflush(s->fp);
+
+  free(s);
+  return;
+}
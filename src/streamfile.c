@@ -0,0 +1,559 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "streamfile.h"
+
+/* a layer to support buffered reads from files, pipes, and stdin */
+/* optionally reading a multifile series as one stream, or following */
+/* it while it is being written */
+
+static long stream_fill( struct STREAMFILE *, char *, long, long );
+static int  stream_wait( struct STREAMFILE * );
+static long long stream_next( char *, char * );
+static int  stream_switch( struct STREAMFILE *, char * );
+static void *stream_ahead( void * );
+static int  stream_slot( struct STREAMFILE * );
+
+/******************************************************************************/
+/*	stream_open							      */
+/******************************************************************************/
+struct STREAMFILE *stream_open (char *name, long size)
+{
+  /* opens the named file for reading, or stdin if name is "-"
+     size is the readahead buffer size, STREAM_BUFSIZE if 0
+     returns NULL if the file cannot be opened
+  */
+  struct STREAMFILE *s;
+  struct stat filestat;
+
+  s = (struct STREAMFILE *) calloc(1, sizeof(struct STREAMFILE));
+  if (s == NULL)
+    return NULL;
+
+  if (name[0] == '-' && name[1] == '\0')
+    s->fd = STDIN_FILENO;
+  else if ((s->fd = open(name, O_RDONLY)) < 0)
+    {
+      free(s);
+      return NULL;
+    }
+  strncpy(s->name, name, sizeof(s->name) - 1);
+
+  /* only regular files can be skipped with lseek */
+  s->seekable = (fstat(s->fd, &filestat) == 0 && S_ISREG(filestat.st_mode));
+
+  s->size = (size > 0) ? size : STREAM_BUFSIZE;
+  s->buf = (char *) malloc(s->size);
+  if (s->buf == NULL)
+    {
+      if (s->fd != STDIN_FILENO) close(s->fd);
+      free(s);
+      return NULL;
+    }
+
+  return s;
+}
+
+/******************************************************************************/
+/*	stream_fill							      */
+/******************************************************************************/
+static long stream_fill (struct STREAMFILE *s, char *buf, long want, long room)
+{
+  /* reads until at least want bytes, and at most room bytes, have been
+     placed in buf, or until EOF
+     pipes and files being written deliver data in small pieces, so short
+     reads are retried
+     returns the number of bytes read, or -1 on error
+  */
+  char next[sizeof(s->name) + 8];
+  long got = 0;
+  ssize_t n;
+
+  while (got < want && !s->eof)
+    {
+      n = read(s->fd, buf + got, room - got);
+      if (n < 0)
+	{
+	  if (errno == EINTR) continue;
+	  perror("stream_fill: read");
+	  return -1;
+	}
+      if (n > 0)
+	{
+	  s->idle = 0;
+	  s->drained = 0;
+	}
+      else if (s->series && s->fd != STDIN_FILENO && stream_next(s->name, next) >= 0)
+	{
+	  if (stream_switch(s, next) < 0)
+	    return -1;
+	}
+      else if (!s->follow || !stream_wait(s))
+	s->eof = 1;
+      got += n;
+    }
+
+  return got;
+}
+
+/******************************************************************************/
+/*	stream_follow							      */
+/******************************************************************************/
+void stream_follow (struct STREAMFILE *s, int timeout)
+{
+  /* at EOF, keep waiting up to timeout seconds for the file to grow,
+     and continue with the next file of a prefix.000, prefix.001, ...
+     series written by multi_write once data appear in it
+  */
+  char next[sizeof(s->name) + 8];
+
+  s->follow = timeout;
+  s->hasnext = (stream_next(s->name, next) >= 0);
+  return;
+}
+
+/******************************************************************************/
+/*	stream_series							      */
+/******************************************************************************/
+void stream_series (struct STREAMFILE *s)
+{
+  /* at EOF, continue with the next file of a completed prefix.000,
+     prefix.001, ... series, so that the series reads as a single file
+  */
+  s->series = 1;
+  return;
+}
+
+/******************************************************************************/
+/*	stream_limit							      */
+/******************************************************************************/
+void stream_limit (struct STREAMFILE *s, long long limit)
+{
+  /* delivers data only up to byte offset limit, as if EOF were there */
+  s->limit = limit;
+  return;
+}
+
+/******************************************************************************/
+/*	stream_readahead						      */
+/******************************************************************************/
+int stream_readahead (struct STREAMFILE *s, int nslots)
+{
+  /* starts a thread that reads the stream ahead of the caller, in chunks
+     of the readahead buffer size, into a ring of nslots chunks
+     (STREAM_SLOTS if 0), so that reading overlaps processing and each
+     file is read in long sequential pieces even when several are read
+     in turn; data already buffered are delivered first, and follow,
+     series and limit settings must be made before
+     returns 0, or -1 if the ring cannot be allocated
+  */
+  long left;
+
+  if (nslots <= 0) nslots = STREAM_SLOTS;
+  s->ring = (char *) malloc((long) nslots * s->size);
+  s->fill = (long *) calloc(nslots, sizeof(long));
+  if (!s->ring || !s->fill)
+    {
+      free(s->ring);
+      free(s->fill);
+      return -1;
+    }
+  s->nslots = nslots;
+
+  /* the unread part of the buffer becomes the first chunk */
+  left = s->len - s->pos;
+  memcpy(s->ring, s->buf + s->pos, left);
+  s->fill[0] = left;
+  s->head = (left > 0);
+  s->tail = 0;
+  free(s->buf);
+  s->buf = s->ring;
+  s->pos = s->len = 0;
+
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  s->ahead = 1;
+  s->done = s->eof;
+  if (!s->done)
+    {
+      if (pthread_create(&s->tid, NULL, stream_ahead, (void *) s) == 0)
+	s->thread = 1;
+      else
+	{
+	  perror("stream_readahead: pthread_create");
+	  s->done = -1;
+	}
+    }
+  return 0;
+}
+
+/******************************************************************************/
+/*	stream_ahead							      */
+/******************************************************************************/
+static void *stream_ahead (void *arg)
+{
+  /* readahead thread: fills the free chunks of the ring in turn; once
+     started, it alone uses the file descriptor
+  */
+  struct STREAMFILE *s = (struct STREAMFILE *) arg;
+  char *chunk;
+  long n;
+  int  fd = -1;
+
+  while (!s->done)
+    {
+      /* wait for a free chunk; the one being consumed is not free */
+      pthread_mutex_lock(&s->lock);
+      while (s->head - s->tail >= s->nslots)
+	pthread_cond_wait(&s->cond, &s->lock);
+      pthread_mutex_unlock(&s->lock);
+      chunk = s->ring + (s->head % s->nslots) * s->size;
+
+      /* the kernel may read well ahead of a file read sequentially;
+	 files of a series are advised as they are opened */
+      if (s->seekable && s->fd != fd)
+	posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      fd = s->fd;
+
+      n = stream_fill(s, chunk, s->size, s->size);
+
+      pthread_mutex_lock(&s->lock);
+      if (n > 0)
+	{
+	  s->fill[s->head % s->nslots] = n;
+	  s->head++;
+	}
+      if (n < 0)
+	s->done = -1;
+      else if (s->eof)
+	s->done = 1;
+      pthread_cond_broadcast(&s->cond);
+      pthread_mutex_unlock(&s->lock);
+    }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/*	stream_slot							      */
+/******************************************************************************/
+static int stream_slot (struct STREAMFILE *s)
+{
+  /* releases the chunk of the ring being consumed, if any, and makes the
+     next one the readahead buffer, waiting for it if needed
+     returns 1, 0 at EOF, or -1 on a read error
+  */
+  int status;
+
+  pthread_mutex_lock(&s->lock);
+  if (s->len > 0)
+    {
+      s->tail++;
+      s->pos = s->len = 0;
+      pthread_cond_broadcast(&s->cond);
+    }
+  while (s->head <= s->tail && !s->done)
+    pthread_cond_wait(&s->cond, &s->lock);
+  if (s->head > s->tail)
+    {
+      s->buf = s->ring + (s->tail % s->nslots) * s->size;
+      s->len = s->fill[s->tail % s->nslots];
+      status = 1;
+    }
+  else
+    status = (s->done < 0) ? -1 : 0;
+  pthread_mutex_unlock(&s->lock);
+
+  return status;
+}
+
+/******************************************************************************/
+/*	stream_size							      */
+/******************************************************************************/
+long long stream_size (char *name, int series)
+{
+  /* returns the size of the named file, plus that of the files following
+     it in a multifile series if series is set, or -1 if it does not exist
+  */
+  struct stat filestat;
+  char cur[sizeof(((struct STREAMFILE *) 0)->name) + 8];
+  char next[sizeof(cur)];
+  long long size, total;
+
+  if (stat(name, &filestat) < 0)
+    return -1;
+  total = filestat.st_size;
+
+  strncpy(cur, name, sizeof(cur) - 9);
+  cur[sizeof(cur) - 9] = '\0';
+  while (series && (size = stream_next(cur, next)) >= 0)
+    {
+      total += size;
+      strcpy(cur, next);
+    }
+  return total;
+}
+
+/******************************************************************************/
+/*	stream_next							      */
+/******************************************************************************/
+static long long stream_next (char *name, char *next)
+{
+  /* builds the name of the file following name in a multifile series
+     returns the size of that file, or -1 if it does not exist
+  */
+  struct stat filestat;
+  char *ext;
+  int n;
+
+  ext = strrchr(name, '.');
+  if (ext == NULL || strlen(ext) != 4 || sscanf(ext + 1, "%3d", &n) != 1)
+    return -1;
+
+  strcpy(next, name);
+  sprintf(next + (ext - name), ".%03d", n + 1);
+
+  if (stat(next, &filestat) < 0)
+    return -1;
+  return filestat.st_size;
+}
+
+/******************************************************************************/
+/*	stream_switch							      */
+/******************************************************************************/
+static int stream_switch (struct STREAMFILE *s, char *next)
+{
+  /* continues reading with file next of the series
+     returns 0, or -1 if it cannot be opened
+  */
+  struct stat filestat;
+  int fd;
+
+  if ((fd = open(next, O_RDONLY)) < 0)
+    {
+      perror("stream_switch: open next file");
+      return -1;
+    }
+  close(s->fd);
+  s->fd = fd;
+  strcpy(s->name, next);
+  s->seekable = (fstat(s->fd, &filestat) == 0 && S_ISREG(filestat.st_mode));
+  return 0;
+}
+
+/******************************************************************************/
+/*	stream_wait							      */
+/******************************************************************************/
+static int stream_wait (struct STREAMFILE *s)
+{
+  /* called at EOF in follow mode
+     returns 1 if more data may be read, 0 if the recording has ended
+  */
+  char next[sizeof(s->name) + 8];
+  long long nextsize;
+
+  if (s->fd == STDIN_FILENO)
+    return 0;
+
+  nextsize = stream_next(s->name, next);
+
+  /* the writer has moved on to the next file: read the tail of the
+     current file once more, then switch */
+  if (nextsize > 0)
+    {
+      if (!s->drained)
+	{
+	  s->drained = 1;
+	  return 1;
+	}
+      if (stream_switch(s, next) < 0)
+	return 0;
+      fprintf(stderr,"Continuing with %s\n", s->name);
+      s->hasnext = (stream_next(s->name, next) >= 0);
+      s->idle = 0;
+      s->drained = 0;
+      return 1;
+    }
+
+  /* unused files of the series are removed when the recording stops */
+  if (s->hasnext && nextsize < 0)
+    {
+      if (!s->drained)
+	{
+	  s->drained = 1;
+	  return 1;
+	}
+      return 0;
+    }
+
+  /* otherwise wait for the file to grow */
+  if (s->idle >= 1000 * s->follow)
+    return 0;
+  usleep(1000 * STREAM_POLL_MS);
+  s->idle += STREAM_POLL_MS;
+  return 1;
+}
+
+/******************************************************************************/
+/*	stream_read							      */
+/******************************************************************************/
+long stream_read (struct STREAMFILE *s, char *buf, long len)
+{
+  /* makes the interface just like read, except that fewer than len bytes
+     are returned only at EOF
+     requests larger than the readahead buffer bypass it
+  */
+  long got = 0;
+  long n;
+
+  /* nothing is delivered beyond the limit */
+  if (s->limit && len > s->limit - s->offset)
+    len = (s->limit > s->offset) ? s->limit - s->offset : 0;
+
+  while (got < len)
+    {
+      /* serve from readahead buffer */
+      if (s->pos < s->len)
+	{
+	  n = s->len - s->pos;
+	  if (n > len - got) n = len - got;
+	  memcpy(buf + got, s->buf + s->pos, n);
+	  s->pos += n;
+	  got += n;
+	  continue;
+	}
+
+      /* next chunk of the ring, when reading ahead */
+      if (s->ahead)
+	{
+	  if ((n = stream_slot(s)) < 0)
+	    return -1;
+	  if (n == 0)
+	    break;
+	  continue;
+	}
+
+      if (s->eof)
+	break;
+
+      /* large request, read directly into caller's buffer */
+      if (len - got >= s->size)
+	{
+	  if ((n = stream_fill(s, buf + got, len - got, len - got)) < 0)
+	    return -1;
+	  got += n;
+	  continue;
+	}
+
+      /* refill readahead buffer, without waiting for more than needed */
+      s->pos = 0;
+      if ((s->len = stream_fill(s, s->buf, len - got, s->size)) < 0)
+	{
+	  s->len = 0;
+	  return -1;
+	}
+    }
+
+  s->offset += got;
+  return got;
+}
+
+/******************************************************************************/
+/*	stream_skip							      */
+/******************************************************************************/
+long long stream_skip (struct STREAMFILE *s, long long nbytes)
+{
+  /* skips nbytes, with lseek on regular files and by reading and
+     discarding data on pipes
+     returns the number of bytes skipped, less than nbytes at EOF
+  */
+  char next[sizeof(s->name) + 8];
+  long long skipped = 0;
+  long long n;
+  off_t cur, end;
+
+  /* first consume what is already buffered */
+  n = s->len - s->pos;
+  if (n > nbytes) n = nbytes;
+  s->pos += n;
+  skipped += n;
+
+  /* the readahead thread owns the file, so chunks are discarded */
+  while (skipped < nbytes && s->ahead)
+    {
+      if ((n = stream_slot(s)) < 0)
+	return -1;
+      if (n == 0)
+	break;
+      n = s->len;
+      if (n > nbytes - skipped) n = nbytes - skipped;
+      s->pos += n;
+      skipped += n;
+    }
+
+  while (skipped < nbytes && !s->ahead && s->seekable)
+    {
+      /* do not seek past EOF */
+      cur = lseek(s->fd, 0, SEEK_CUR);
+      end = lseek(s->fd, 0, SEEK_END);
+      n = nbytes - skipped;
+      if (n > end - cur) n = end - cur;
+      if (lseek(s->fd, cur + n, SEEK_SET) != cur + n)
+	{
+	  perror("stream_skip: lseek");
+	  return -1;
+	}
+      skipped += n;
+
+      /* whole files of a series are skipped without reading them */
+      if (skipped == nbytes || !s->series || stream_next(s->name, next) < 0)
+	break;
+      if (stream_switch(s, next) < 0)
+	return -1;
+    }
+
+  while (skipped < nbytes && !s->ahead && !s->eof)
+    {
+      n = nbytes - skipped;
+      if (n > s->size) n = s->size;
+      if ((n = stream_fill(s, s->buf, n, n)) < 0)
+	return -1;
+      skipped += n;
+    }
+
+  s->offset += skipped;
+  return skipped;
+}
+
+/******************************************************************************/
+/*	stream_close							      */
+/******************************************************************************/
+int stream_close (struct STREAMFILE *s)
+{
+  int status = 0;
+
+  /* the readahead thread may be waiting in a read, or for a free chunk */
+  if (s->thread)
+    {
+      pthread_cancel(s->tid);
+      pthread_join(s->tid, NULL);
+    }
+  if (s->fd != STDIN_FILENO)
+    status = close(s->fd);
+  if (s->ahead)
+    {
+      free(s->ring);
+      free(s->fill);
+    }
+  else
+    free(s->buf);
+  free(s);
+
+  return status;
+}
@@ -3,9 +3,41 @@
 
 fft_param_1=0
 down_param_1=0
+pipe_param_1=0
+sk_param_1=0
+spec_param_1=0
+pol_param_1=0
+fir_param_1=0
+cic_param_1=0
+prod_param_1=0
+pow_param_1=0
+cicint_param_1=0
+ddc_param_1=0
 
 # test tone data
 
+# generated tone data: 2000000 complex samples of 8-bit I and Q (mode 8) of
+# a tone of amplitude 60 at 0.002 cycles per sample, which is 2 kHz for a
+# sampling frequency of 1 MHz
+
+LC_ALL=C awk 'BEGIN { pi = atan2(0, -1);
+  for (n = 0; n < 2000000; n++) {
+    i = int(60 * cos(2 * pi * 0.002 * n) + 256.5) % 256;
+    q = int(60 * sin(2 * pi * 0.002 * n) + 256.5) % 256;
+    printf "%c%c", i, q } }' > gen_tone.bin
+
+# the same at 0.00005 cycles per sample, 0.05 of the output rate when
+# downsampled by 1000
+
+LC_ALL=C awk 'BEGIN { pi = atan2(0, -1);
+  for (n = 0; n < 2000000; n++) {
+    i = int(60 * cos(2 * pi * 0.00005 * n) + 256.5) % 256;
+    q = int(60 * sin(2 * pi * 0.00005 * n) + 256.5) % 256;
+    printf "%c%c", i, q } }' > gen_slow.bin
+
+# rms of the floats in a file, after skipping the optional number of bytes
+rms () { od -An -v -j ${2:-0} -f $1 | awk '{for (i = 1; i <= NF; i++) {s += $i * $i; n++}} END {if (n) print sqrt(s / n); else print 0}'; }
+
 # Test 1: fft
 
 pfs_fft -m 32 -r 2.98023223876953125 -n 1 -f 3.125 -s 1000,11000 -b -o result.fftb test_tone.bin 
@@ -32,7 +64,15 @@ if [ $(du -k result_hd.cmp | cut -f1) -eq "0" ];then # test failed because outpu
     fft_param_1=0;
 fi
 
-# Test 2: downsampling 
+# Test 2: fft of data read from a pipe must match Test 1
+
+cat test_tone.bin | pfs_fft -m 32 -r 2.98023223876953125 -n 1 -f 3.125 -s 1000,11000 -b -o result.pipe.fftb - 
+
+if [ -s test_tone.bin ] && [ -s result.pipe.fftb ] && cmp -s result.fftb result.pipe.fftb; then # test passed because outputs are identical and not empty
+    pipe_param_1=1; else pipe_param_1=0;
+fi
+
+# Test 3: downsampling 
 
 pfs_downsample -m 32 -d 1000 -s 1000 -I 0.0354 -Q -0.0148 -o result.d1000 test_tone.bin 
 
@@ -50,6 +90,128 @@ if [ $(du -k err | cut -f1) -eq "0" ];then # test passed because comparison show
     down_param_1=1; else down_param_1=0;
 fi
 
+# Test 4: spectral kurtosis excision must keep a steady carrier, whose
+# kurtosis is below that of noise, at the power it has without excision
+
+pfs_fft -m 8 -f 1 -r 1000 -n 200 -o result.sk0 gen_tone.bin
+pfs_fft -m 8 -f 1 -r 1000 -n 200 -K 200,3 -o result.sk1 gen_tone.bin
+
+paste result.sk0 result.sk1 | awk '{if ($2 > p) {p = $2; k = $4}} END {if (p > 0 && k > 0.999 * p && k < 1.001 * p) print "ok"}' > err
+
+if [ "$(cat err)" = "ok" ];then # test passed because the carrier keeps its power
+    sk_param_1=1; else sk_param_1=0;
+fi
+
+# Test 5: a file of spectra must hold the "PFSSPEC" header padded to 4096
+# bytes, the same spectra as the binary time series, and an index of 16
+# bytes per spectrum
+
+pfs_fft -m 8 -f 1 -r 10000 -n 20 -t -b -o result.ts gen_tone.bin
+pfs_fft -m 8 -f 1 -r 10000 -n 20 -t -e -o result.spc gen_tone.bin
+
+nspec=$(( $(stat -c %s result.ts) / 400 ))
+
+if [ "$(head -c 7 result.spc)" = "PFSSPEC" ] && [ $nspec -eq 1000 ] && \
+   [ $(stat -c %s result.spc) -eq $(( 4096 + nspec * (400 + 16) )) ] && \
+   tail -c +4097 result.spc | head -c $(( nspec * 400 )) | cmp -s - result.ts; then # test passed because layout and spectra match
+    spec_param_1=1; else spec_param_1=0;
+fi
+
+# Test 6: the cross products of an input with itself must equal its power,
+# with no imaginary part, in every channel including DC, for an odd FFT
+# length (977)
+
+pfs_fft_2 -m 8 -f 1 -r 1024 -n 2 -Q products -o result.pol gen_tone.bin gen_tone.bin
+
+awk '{if ($4 > 1.001 * $2 || $4 < 0.999 * $2 || $5 != 0) bad++} END {if (NR == 977 && bad == 0) print "ok"}' result.pol > err
+
+if [ "$(cat err)" = "ok" ];then # test passed because all channels match
+    pol_param_1=1; else pol_param_1=0;
+fi
+
+# Test 7: the lowpass filter of -L must have the passband gain of the sum
+# of consecutive samples, within 1%
+
+pfs_downsample -m 8 -d 10 -o result.box gen_tone.bin
+pfs_downsample -m 8 -d 10 -L 80 -o result.fir gen_tone.bin
+
+awk -v a=$(rms result.box) -v b=$(rms result.fir) 'BEGIN {if (a > 0 && b > 0.99 * a && b < 1.01 * a) print "ok"}' > err
+
+if [ "$(cat err)" = "ok" ];then # test passed because the gains match
+    fir_param_1=1; else fir_param_1=0;
+fi
+
+# Test 8: downsampling float samples in stages (CIC, compensating and
+# half-band filters) must keep the precision of weak signals: the tone
+# scaled by 1e-4 must come out at 1e-4 of the rms of the unscaled tone,
+# within 1%; -d 1 with -f 7.96875 writes the 8-bit samples as floats
+
+pfs_downsample -m 8 -d 1 -f 7.96875 -o result.f1 gen_tone.bin
+pfs_downsample -m 8 -d 1 -f 0.000796875 -o result.f2 gen_tone.bin
+pfs_downsample -m 32 -d 100 -L 800 -o result.cic1 result.f1
+pfs_downsample -m 32 -d 100 -L 800 -o result.cic2 result.f2
+
+awk -v a=$(rms result.cic1) -v b=$(rms result.cic2) 'BEGIN {if (a > 0 && b > 0.99e-4 * a && b < 1.01e-4 * a) print "ok"}' > err
+
+if [ "$(cat err)" = "ok" ];then # test passed because the weak tone keeps its amplitude
+    cic_param_1=1; else cic_param_1=0;
+fi
+
+# Test 9: a product of -P must be identical to the same downsampling done
+# on its own, and the product by 100 made from it must be a tenth its size
+
+pfs_downsample -m 8 -L 8 -T 3 -P 1,10,result.p10 -P 1,100,result.p100 gen_tone.bin
+pfs_downsample -m 8 -d 10 -L 80 -T 1 -o result.s10 gen_tone.bin
+
+if [ -s result.s10 ] && cmp -s result.p10 result.s10 && \
+   [ $(stat -c %s result.p10) -eq $(( 10 * $(stat -c %s result.p100) )) ]; then # test passed because the products match
+    prod_param_1=1; else prod_param_1=0;
+fi
+
+# Test 10: the integrated power of -W must be the sum of I^2 + Q^2 of the
+# samples, written as floats by -d 1 with -f 7.96875, over each 10 samples;
+# the first 10000 sums are compared
+
+pfs_downsample -m 8 -d 10 -W single -T 3 -o result.pow gen_tone.bin
+pfs_downsample -m 8 -d 1 -f 7.96875 -o result.unscaled gen_tone.bin
+
+od -An -v -f -N 800000 result.unscaled | awk '{for (i = 1; i <= NF; i++) {s += $i * $i; if (++n % 20 == 0) {print s; s = 0}}}' > correct_pow.cmp
+od -An -v -f -N 40000 result.pow | awk '{for (i = 1; i <= NF; i++) print $i}' > result_pow.cmp
+
+paste correct_pow.cmp result_pow.cmp | awk '{if ($1 != $2) bad++} END {if (NR == 10000 && bad == 0) print "ok"}' > err
+
+if [ "$(cat err)" = "ok" ];then # test passed because the powers match
+    pow_param_1=1; else pow_param_1=0;
+fi
+
+# Test 11: downsampling 8-bit samples by 1000 in stages (integer CIC,
+# compensating and half-band filters) must have the passband gain of the
+# sum of consecutive samples, within 1%
+
+pfs_downsample -m 8 -d 1000 -o result.slowbox gen_slow.bin
+pfs_downsample -m 8 -d 1000 -L 8 -o result.slowcic gen_slow.bin
+
+awk -v a=$(rms result.slowbox) -v b=$(rms result.slowcic) 'BEGIN {if (a > 0 && b > 0.99 * a && b < 1.01 * a) print "ok"}' > err
+
+if [ "$(cat err)" = "ok" ];then # test passed because the gains match
+    cicint_param_1=1; else cicint_param_1=0;
+fi
+
+# Test 12: the 2 kHz tone selected with -C 2000 and -B 400 must come out at
+# the gain of the sum of consecutive samples shifted by the same frequency,
+# within 1%, and the image at -C -2000 must be rejected; the first 50
+# outputs are skipped while the filters fill
+
+pfs_downsample -m 8 -F 1 -C 2000 -d 2000 -o result.ddcbox gen_tone.bin
+pfs_downsample -m 8 -F 1 -C 2000 -B 400 -o result.ddcpos gen_tone.bin
+pfs_downsample -m 8 -F 1 -C -2000 -B 400 -o result.ddcneg gen_tone.bin
+
+awk -v a=$(rms result.ddcbox 400) -v b=$(rms result.ddcpos 400) -v c=$(rms result.ddcneg 400) 'BEGIN {if (a > 0 && b > 0.99 * a && b < 1.01 * a && c < 0.001 * a) print "ok"}' > err
+
+if [ "$(cat err)" = "ok" ];then # test passed because the tone is selected
+    ddc_param_1=1; else ddc_param_1=0;
+fi
+
 
 #=====================================================
 
@@ -58,11 +220,31 @@ echo "================================================="
 echo "=                    RESULTS                    ="
 echo "================================================="
 if [ $fft_param_1 -eq 1 ]; then echo " FFT test PASSED "; fi
+if [ $pipe_param_1 -eq 1 ]; then echo " FFT from pipe test PASSED "; fi
 if [ $down_param_1 -eq 1 ]; then echo " Downsampling test PASSED "; fi
+if [ $sk_param_1 -eq 1 ]; then echo " Spectral kurtosis carrier test PASSED "; fi
+if [ $spec_param_1 -eq 1 ]; then echo " File of spectra test PASSED "; fi
+if [ $pol_param_1 -eq 1 ]; then echo " Cross products test PASSED "; fi
+if [ $fir_param_1 -eq 1 ]; then echo " Filter passband gain test PASSED "; fi
+if [ $cic_param_1 -eq 1 ]; then echo " CIC weak float signal test PASSED "; fi
+if [ $prod_param_1 -eq 1 ]; then echo " Multiple products test PASSED "; fi
+if [ $pow_param_1 -eq 1 ]; then echo " Power integration test PASSED "; fi
+if [ $cicint_param_1 -eq 1 ]; then echo " CIC passband gain test PASSED "; fi
+if [ $ddc_param_1 -eq 1 ]; then echo " Digital downconverter test PASSED "; fi
 
 if [ $fft_param_1 -eq 0 ]; then echo " FFT test FAILED "; fi
+if [ $pipe_param_1 -eq 0 ]; then echo " FFT from pipe test FAILED "; fi
 if [ $down_param_1 -eq 0 ]; then echo " Downsampling test FAILED "; fi
+if [ $sk_param_1 -eq 0 ]; then echo " Spectral kurtosis carrier test FAILED "; fi
+if [ $spec_param_1 -eq 0 ]; then echo " File of spectra test FAILED "; fi
+if [ $pol_param_1 -eq 0 ]; then echo " Cross products test FAILED "; fi
+if [ $fir_param_1 -eq 0 ]; then echo " Filter passband gain test FAILED "; fi
+if [ $cic_param_1 -eq 0 ]; then echo " CIC weak float signal test FAILED "; fi
+if [ $prod_param_1 -eq 0 ]; then echo " Multiple products test FAILED "; fi
+if [ $pow_param_1 -eq 0 ]; then echo " Power integration test FAILED "; fi
+if [ $cicint_param_1 -eq 0 ]; then echo " CIC passband gain test FAILED "; fi
+if [ $ddc_param_1 -eq 0 ]; then echo " Digital downconverter test FAILED "; fi
 
 # clean up 
 rm *tmp1 *tmp2 *cmp err
-rm result*
+rm result* gen_*